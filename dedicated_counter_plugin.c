@@ -0,0 +1,62 @@
+// Example strategy plugin, a port of DedicatedCounterPrisoner. Build it with
+// make dedicated_counter_plugin.so and run it with
+// prisoners PluginDedicatedCounterPrisoner 100 1000 --plugin ./dedicated_counter_plugin.so,
+// whose self-test checks that it takes the days of the built-in strategy.
+
+#include <stdlib.h>
+
+#include "prisoners_plugin.h"
+
+typedef struct Simulation {
+    int32_t n_prisoners;
+    int32_t light_is_on;
+    int32_t times_turned_off_the_light;
+    // Whether each prisoner has turned the light on, prisoner 0 being the counter.
+    uint8_t has_turned_on_the_light[];
+} Simulation;
+
+static void *CreateSimulation(int32_t n_prisoners) {
+    Simulation *simulation = calloc(1, sizeof(Simulation) + (size_t)n_prisoners);
+    if (simulation) {
+        simulation->n_prisoners = n_prisoners;
+    }
+    return simulation;
+}
+
+static int64_t RunDays(void *opaque_simulation, const int32_t *visitors, int64_t n_days) {
+    Simulation *simulation = opaque_simulation;
+    for (int64_t i = 0; i < n_days; ++i) {
+        int32_t prisoner_id = visitors[i];
+        if (prisoner_id == 0) {
+            if (simulation->light_is_on) {
+                simulation->light_is_on = 0;
+                ++simulation->times_turned_off_the_light;
+            }
+            if (simulation->times_turned_off_the_light == simulation->n_prisoners - 1) {
+                return i;
+            }
+        } else if (!simulation->has_turned_on_the_light[prisoner_id] &&
+                   !simulation->light_is_on) {
+            simulation->light_is_on = 1;
+            simulation->has_turned_on_the_light[prisoner_id] = 1;
+        }
+    }
+    return n_days;
+}
+
+static void DestroySimulation(void *simulation) {
+    free(simulation);
+}
+
+static const PrisonersPluginStrategy kStrategies[] = {
+    {"PluginDedicatedCounterPrisoner", CreateSimulation, RunDays, DestroySimulation},
+};
+
+const PrisonersPluginStrategy *prisoners_plugin_get_strategies(int32_t abi_version,
+                                                               int32_t *n_strategies) {
+    if (abi_version != PRISONERS_PLUGIN_ABI_VERSION) {
+        return NULL;
+    }
+    *n_strategies = (int32_t)(sizeof(kStrategies) / sizeof(kStrategies[0]));
+    return kStrategies;
+}
@@ -0,0 +1,4643 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+#include "prisoners.h"
+#include "prisoners_plugin.h"
+
+// Everything but the API of prisoners.h is internal to this file.
+namespace {
+
+namespace rng {
+std::random_device &GetDevice() {
+    static std::random_device random_device;
+    return random_device;
+}
+
+// Every thread has its own generator, seeded from the shared device.
+std::mt19937 &GetGenerator() {
+    thread_local std::mt19937 generator = [] {
+        static std::mutex device_mutex;
+        std::lock_guard lock{device_mutex};
+        return std::mt19937(GetDevice()());
+    }();
+    return generator;
+}
+
+// Gives the thread its generator back as it was, if active, once the scope ends. Seeded work
+// reseeds the generator of every thread it runs on, its caller's thread included.
+class ScopedGeneratorState {
+public:
+    explicit ScopedGeneratorState(bool is_active) {
+        if (is_active) {
+            saved_generator_ = GetGenerator();
+        }
+    }
+
+    ScopedGeneratorState(const ScopedGeneratorState &) = delete;
+    ScopedGeneratorState &operator=(const ScopedGeneratorState &) = delete;
+
+    ~ScopedGeneratorState() {
+        if (saved_generator_) {
+            GetGenerator() = *saved_generator_;
+        }
+    }
+
+private:
+    std::optional<std::mt19937> saved_generator_;
+};
+}  // namespace rng
+
+namespace parallel {
+int32_t GetNThreads() {
+    return static_cast<int32_t>(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// Calls function(i) for every i in [0, n_items) on n_threads threads, rethrowing the first
+// exception once all threads have finished.
+template <class Function>
+void ForEachIndex(int32_t n_items, int32_t n_threads, Function function) {
+    std::atomic<int32_t> next_index = 0;
+    std::exception_ptr exception;
+    std::mutex exception_mutex;
+    auto work = [&] {
+        for (int32_t i; (i = next_index++) < n_items;) {
+            try {
+                function(i);
+            } catch (...) {
+                std::lock_guard lock{exception_mutex};
+                if (not exception) {
+                    exception = std::current_exception();
+                }
+                next_index = n_items;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int32_t i = 1; i < std::min(n_threads, n_items); ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+}  // namespace parallel
+
+namespace numa {
+// Parses sysfs CPU lists such as "0-3,8,10-11".
+std::vector<int32_t> ParseCpuList(const std::string &cpu_list) {
+    std::vector<int32_t> cpus;
+    std::istringstream iss{cpu_list};
+    for (std::string range; std::getline(iss, range, ',');) {
+        if (range.find_first_not_of(" \n") == std::string::npos) {
+            continue;
+        }
+        auto dash = range.find('-');
+        auto first = std::stoi(range.substr(0, dash));
+        auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// CPUs of every NUMA node, or a single node with every CPU when there is no NUMA topology.
+std::vector<std::vector<int32_t>> GetNodeCpus() {
+    std::vector<std::pair<int32_t, std::vector<int32_t>>> nodes;
+    std::error_code error_code;
+    for (const auto &entry :
+         std::filesystem::directory_iterator{"/sys/devices/system/node", error_code}) {
+        auto name = entry.path().filename().string();
+        if (not name.starts_with("node") or name.size() == 4 or
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream file{entry.path() / "cpulist"};
+        std::string cpu_list;
+        std::getline(file, cpu_list);
+        if (auto cpus = ParseCpuList(cpu_list); not cpus.empty()) {
+            nodes.emplace_back(std::stoi(name.substr(4)), std::move(cpus));
+        }
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    std::vector<std::vector<int32_t>> node_cpus;
+    for (auto &[node, cpus] : nodes) {
+        node_cpus.push_back(std::move(cpus));
+    }
+    if (node_cpus.empty()) {
+        node_cpus.emplace_back(parallel::GetNThreads());
+        std::iota(node_cpus.front().begin(), node_cpus.front().end(), 0);
+    }
+    return node_cpus;
+}
+
+bool PinCurrentThreadToCpu([[maybe_unused]] int32_t cpu) {
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Pins the current thread to the CPU, if any, while it lives, and then lets the thread run on
+// the CPUs it could before. Workers run on their caller's thread too, and threads inherit the
+// CPUs of the thread that creates them, so a pin left behind would confine later threads.
+class ScopedCpuPin {
+public:
+    explicit ScopedCpuPin(std::optional<int32_t> cpu) {
+        if (not cpu) {
+            return;
+        }
+#ifdef __linux__
+        has_saved_cpu_set_ = sched_getaffinity(0, sizeof(saved_cpu_set_), &saved_cpu_set_) == 0;
+#endif
+        PinCurrentThreadToCpu(*cpu);
+    }
+
+    ScopedCpuPin(const ScopedCpuPin &) = delete;
+    ScopedCpuPin &operator=(const ScopedCpuPin &) = delete;
+
+    ~ScopedCpuPin() {
+#ifdef __linux__
+        if (has_saved_cpu_set_) {
+            sched_setaffinity(0, sizeof(saved_cpu_set_), &saved_cpu_set_);
+        }
+#endif
+    }
+
+private:
+#ifdef __linux__
+    cpu_set_t saved_cpu_set_{};
+    bool has_saved_cpu_set_ = false;
+#endif
+};
+}  // namespace numa
+
+namespace report {
+// CPU time of all threads of the process.
+double GetProcessCpuSeconds() {
+#ifdef __linux__
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#else
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Peak resident set size of the process, or 0 where it isn't known.
+int64_t GetPeakRssKilobytes() {
+#ifdef __linux__
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// Time spent building stage schedules, summed over threads. Schedules are built inside
+// simulations, so this is part of their time.
+std::atomic<int64_t> &GetScheduleBuildNanoseconds() {
+    static std::atomic<int64_t> nanoseconds = 0;
+    return nanoseconds;
+}
+
+struct Phase {
+    std::string name;
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+};
+
+// Wall and CPU time of the phases of one run of a strategy, and its throughput.
+class RunReport {
+public:
+    template <class Function>
+    decltype(auto) TimePhase(std::string name, Function function) {
+        auto wall_start = std::chrono::steady_clock::now();
+        auto cpu_start = GetProcessCpuSeconds();
+        auto add_phase = [&] {
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+            phases.push_back({std::move(name), wall.count(), GetProcessCpuSeconds() - cpu_start});
+        };
+        if constexpr (std::is_void_v<decltype(function())>) {
+            function();
+            add_phase();
+        } else {
+            decltype(auto) result = function();
+            add_phase();
+            return result;
+        }
+    }
+
+    [[nodiscard]] double GetWallSeconds(const std::string &phase_name) const {
+        for (const auto &phase : phases) {
+            if (phase.name == phase_name) {
+                return phase.wall_seconds;
+            }
+        }
+        return 0;
+    }
+
+    // The threads that ran prisons, which are all of them but the producers.
+    [[nodiscard]] int32_t GetNSimulatingThreads() const {
+        return std::max(1, n_threads - n_producer_threads);
+    }
+
+    void Print(std::ostream &os) const {
+        os << "Run report for " << strategy << ", engine " << engine_version << ", rng " << rng
+           << ':';
+        for (const auto &phase : phases) {
+            os << "\n  " << phase.name << ":\twall " << phase.wall_seconds << " s\tcpu "
+               << phase.cpu_seconds << " s";
+        }
+        os << "\n  schedule building during simulation:\t" << schedule_build_thread_seconds
+           << " thread s";
+        auto simulation_seconds = GetWallSeconds("simulation");
+        os << "\n  simulations:\t" << n_simulations << " on " << n_threads << " threads, "
+           << n_simulations / simulation_seconds / GetNSimulatingThreads()
+           << (n_producer_threads > 0 ? " /s per simulating thread" : " /s per thread");
+        if (n_producer_threads > 0) {
+            os << "\n  visitors drawn on:\t" << n_producer_threads << " producer threads";
+        }
+        if (n_interleaved_prisons > 1) {
+            os << "\n  prisons interleaved:\t" << n_interleaved_prisons << " per thread";
+        }
+        if (n_stored_simulations > 0) {
+            os << "\n  simulations loaded from the results store:\t" << n_stored_simulations;
+        }
+        os << "\n  days simulated:\t" << n_days << ", "
+           << static_cast<double>(n_days) / simulation_seconds << " /s";
+        os << "\n  peak RSS:\t" << peak_rss_kilobytes << " kB";
+    }
+
+    void WriteJson(std::ostream &os) const {
+        auto simulation_seconds = GetWallSeconds("simulation");
+        os << "{\"strategy\": \"" << EscapeJson(strategy) << "\", \"engine_version\": "
+           << engine_version << ", \"rng\": \"" << rng << "\", \"n_prisoners\": " << n_prisoners
+           << ", \"n_threads\": " << n_threads
+           << ", \"n_producer_threads\": " << n_producer_threads
+           << ", \"n_interleaved_prisons\": " << n_interleaved_prisons << ", \"phases\": [";
+        for (size_t i = 0; i < phases.size(); ++i) {
+            os << (i > 0 ? ", " : "") << "{\"name\": \"" << phases[i].name
+               << "\", \"wall_seconds\": " << phases[i].wall_seconds
+               << ", \"cpu_seconds\": " << phases[i].cpu_seconds << '}';
+        }
+        os << "], \"schedule_build_thread_seconds\": " << schedule_build_thread_seconds
+           << ", \"n_simulations\": " << n_simulations
+           << ", \"n_stored_simulations\": " << n_stored_simulations << ", \"n_days\": " << n_days
+           << ", \"days_per_second\": " << static_cast<double>(n_days) / simulation_seconds
+           << ", \"simulations_per_second_per_thread\": "
+           << n_simulations / simulation_seconds / GetNSimulatingThreads()
+           << ", \"peak_rss_kilobytes\": " << peak_rss_kilobytes << '}';
+    }
+
+    std::string strategy;
+    int32_t engine_version = 0;
+    std::string rng = "std::mt19937";
+    int32_t n_prisoners = 0;
+    int32_t n_threads = 0;
+    // Threads that drew visitors for the others in a pipelined run, see RunSimulationsPipelined.
+    int32_t n_producer_threads = 0;
+    // Prisons run at once per thread, see RunInterleavedSimulationRangeInParallel.
+    int32_t n_interleaved_prisons = 1;
+    std::vector<Phase> phases;
+    double schedule_build_thread_seconds = 0;
+    // Simulations and days simulated by the run, which leave out n_stored_simulations loaded
+    // from the results store, so that the rates are of simulating.
+    int64_t n_simulations = 0;
+    int64_t n_days = 0;
+    int64_t n_stored_simulations = 0;
+    int64_t peak_rss_kilobytes = 0;
+
+private:
+    static std::string EscapeJson(const std::string &string) {
+        std::string escaped;
+        for (auto c : string) {
+            if (c == '"' or c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+}  // namespace report
+
+namespace pipeline {
+// Blocks of a simulation start small and double, so that short simulations don't make their
+// producer draw far more visitors than they use.
+constexpr int32_t kMinBlockSize = 16;
+constexpr int32_t kMaxBlockSize = 1024;
+constexpr uint64_t kRingSize = 4;
+
+struct Block {
+    int64_t simulation = -1;
+    int32_t n_visitors = 0;
+    std::array<int32_t, kMaxBlockSize> visitors{};
+};
+
+// Lock-free ring of blocks from one producer thread to one consumer thread. The consumer
+// announces the simulation it runs, and the producer draws that simulation's visitors.
+class BlockRing {
+public:
+    Block *GetFreeBlock() {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kRingSize) {
+            return nullptr;
+        }
+        return &blocks_[tail % kRingSize];
+    }
+
+    void Push() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    const Block *GetFullBlock() const {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &blocks_[head % kRingSize];
+    }
+
+    void Pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    alignas(64) std::atomic<int64_t> consumer_simulation = -1;
+    std::atomic<bool> consumer_is_finished = false;
+
+private:
+    std::array<Block, kRingSize> blocks_;
+    alignas(64) std::atomic<uint64_t> head_ = 0;
+    alignas(64) std::atomic<uint64_t> tail_ = 0;
+};
+
+// Visitors of a prison taken from the blocks of its simulation, skipping any blocks that
+// are left from the consumer's previous simulation.
+class RingVisitors {
+public:
+    RingVisitors() = default;
+
+    RingVisitors(BlockRing &ring, int64_t simulation) : ring{&ring}, simulation{simulation} {
+        ring.consumer_simulation.store(simulation, std::memory_order_release);
+    }
+
+    int32_t Next(std::uniform_int_distribution<int32_t> &) {
+        if (position == n_visitors) {
+            NextBlock();
+        }
+        return block->visitors[position++];
+    }
+
+private:
+    void NextBlock() {
+        if (block) {
+            ring->Pop();
+        }
+        while (true) {
+            block = ring->GetFullBlock();
+            if (not block) {
+                std::this_thread::yield();
+            } else if (block->simulation != simulation) {
+                ring->Pop();
+            } else {
+                break;
+            }
+        }
+        position = 0;
+        n_visitors = block->n_visitors;
+    }
+
+    BlockRing *ring = nullptr;
+    int64_t simulation = -1;
+    const Block *block = nullptr;
+    int32_t position = 0;
+    int32_t n_visitors = 0;
+};
+
+// Draws the visitors of the simulations the consumers of rings announce, until they all
+// finish. Simulation i's visitors come from a generator seeded with seed + i and the prison's
+// distribution, so they are the ones a seeded prison draws inline.
+void Produce(std::span<BlockRing *const> rings, int32_t n_prisoners, uint64_t seed) {
+    struct Stream {
+        std::mt19937 generator;
+        int64_t simulation = -1;
+        int32_t block_size = kMinBlockSize;
+    };
+    std::vector<Stream> streams(rings.size());
+    std::uniform_int_distribution<int32_t> distribution(0, n_prisoners - 1);
+
+    while (true) {
+        auto are_all_finished = true;
+        auto has_produced = false;
+        for (size_t i = 0; i < rings.size(); ++i) {
+            auto &ring = *rings[i];
+            auto &stream = streams[i];
+            if (ring.consumer_is_finished.load(std::memory_order_acquire)) {
+                continue;
+            }
+            are_all_finished = false;
+            auto simulation = ring.consumer_simulation.load(std::memory_order_acquire);
+            if (simulation < 0) {
+                continue;
+            }
+            if (simulation != stream.simulation) {
+                stream.generator.seed(static_cast<std::mt19937::result_type>(seed + simulation));
+                stream.simulation = simulation;
+                stream.block_size = kMinBlockSize;
+            }
+            auto *block = ring.GetFreeBlock();
+            if (not block) {
+                continue;
+            }
+            block->simulation = simulation;
+            block->n_visitors = stream.block_size;
+            for (int32_t j = 0; j < stream.block_size; ++j) {
+                block->visitors[j] = distribution(stream.generator);
+            }
+            ring.Push();
+            stream.block_size = std::min(2 * stream.block_size, kMaxBlockSize);
+            has_produced = true;
+        }
+        if (are_all_finished) {
+            return;
+        }
+        if (not has_produced) {
+            std::this_thread::yield();
+        }
+    }
+}
+}  // namespace pipeline
+
+// Draws the visitors of a prison from the thread's generator as they come.
+struct GeneratorVisitors {
+    int32_t Next(std::uniform_int_distribution<int32_t> &distribution) {
+        return distribution(rng::GetGenerator());
+    }
+};
+
+// Draws the visitors of a prison from its own generator, the next one ahead on request, so that
+// an interleaved prison can prefetch the prisoner of its next day.
+struct LookaheadVisitors {
+    int32_t Next(std::uniform_int_distribution<int32_t> &distribution) {
+        if (next_visitor < 0) {
+            return distribution(generator);
+        }
+        return std::exchange(next_visitor, -1);
+    }
+
+    int32_t Prepare(std::uniform_int_distribution<int32_t> &distribution) {
+        if (next_visitor < 0) {
+            next_visitor = distribution(generator);
+        }
+        return next_visitor;
+    }
+
+    std::mt19937 generator;
+    int32_t next_visitor = -1;
+};
+
+// The room holds a register with n_states states, the classic puzzle being the two state
+// light. Registers with up to 256 states take a single byte.
+template <int32_t n_states>
+class Register {
+public:
+    static_assert(n_states >= 2, "A register must have at least two states.");
+
+    using State = std::conditional_t<n_states <= 256, uint8_t, int32_t>;
+
+    [[nodiscard]] int32_t GetState() const {
+        return state;
+    }
+
+    void SetState(int32_t new_state) {
+        assert(0 <= new_state and new_state < n_states);
+        state = static_cast<State>(new_state);
+    }
+
+    State state = 0;
+};
+
+template <>
+class Register<2> {
+public:
+    [[nodiscard]] bool IsOn() const {
+        return is_on;
+    }
+
+    [[nodiscard]] bool IsOff() const {
+        return not IsOn();
+    }
+
+    void TurnOn() {
+        is_on = true;
+    }
+
+    void TurnOff() {
+        is_on = false;
+    }
+
+    [[nodiscard]] int32_t GetState() const {
+        return is_on;
+    }
+
+    void SetState(int32_t new_state) {
+        assert(new_state == 0 or new_state == 1);
+        is_on = new_state;
+    }
+
+    bool is_on = false;
+};
+
+using Light = Register<2>;
+static_assert(sizeof(Light) == sizeof(bool));
+
+template <class Room>
+struct BasicPrisonerInput {
+    int32_t day_number = 0;
+    Room *light = nullptr;
+};
+
+using PrisonerInput = BasicPrisonerInput<Light>;
+
+enum class PrisonerClaim { claim_nothing, claim_that_everyone_has_been_in_the_room };
+
+template <class Room>
+class BasicPrisonerBase {
+public:
+    using RoomRegister = Room;
+
+    BasicPrisonerBase(int32_t prisoner_id, int32_t n_prisoners)
+        : prisoner_id{prisoner_id}, n_prisoners{n_prisoners} {
+    }
+
+    virtual PrisonerClaim TakeAction(BasicPrisonerInput<Room> input) = 0;
+
+    int32_t prisoner_id = 0;
+    int32_t n_prisoners = 0;
+};
+
+using PrisonerBase = BasicPrisonerBase<Light>;
+
+class FalsePrisonerClaimException : public std::exception {};
+
+template <class Prisoner, class Visitors = GeneratorVisitors>
+class Prison {
+public:
+    template <class... PrisonerArgs>
+    explicit Prison(int32_t n_prisoners, const PrisonerArgs &...prisoner_args)
+        : n_prisoners{n_prisoners},
+          prisoners_have_been_in_the_room_indicators(n_prisoners),
+          distribution_(0, n_prisoners - 1) {
+        for (int32_t i = 0; i < n_prisoners; ++i) {
+            prisoners.emplace_back(i, n_prisoners, prisoner_args...);
+        }
+    }
+
+    [[nodiscard]] bool HaveAllPrisonersBeenInTheRoom() const {
+        return n_prisoners_have_been_in_the_room == n_prisoners;
+    }
+
+    void LetIntoTheRoom(int32_t prisoner_id) {
+        if (not prisoners_have_been_in_the_room_indicators[prisoner_id]) {
+            prisoners_have_been_in_the_room_indicators[prisoner_id] = 1;
+            if (++n_prisoners_have_been_in_the_room == n_prisoners) {
+                all_visited_day_number = day_number + 1;
+            }
+        }
+    }
+
+    // Draws the visitor of the next day and starts loading its prisoner and indicator, for
+    // visitors that can draw ahead.
+    void PrefetchNextDay() {
+        auto prisoner_id = visitors.Prepare(distribution_);
+        __builtin_prefetch(&prisoners[prisoner_id]);
+        __builtin_prefetch(&prisoners_have_been_in_the_room_indicators[prisoner_id]);
+    }
+
+    PrisonerClaim NextDay() {
+        auto prisoner_id = visitors.Next(distribution_);
+        LetIntoTheRoom(prisoner_id);
+        auto prisoner_claim = prisoners[prisoner_id].TakeAction({day_number, &light});
+        ++day_number;
+        return prisoner_claim;
+    }
+
+    int32_t Run() {
+        while (true) {
+            auto prisoner_claim = NextDay();
+            if (prisoner_claim == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+    }
+
+    // Like Run, but gives up once max_n_days days have passed. Prisons are values, so a copy
+    // of an unfinished prison continues the same simulation on fresh random numbers.
+    std::optional<int32_t> RunForAtMost(int32_t max_n_days) {
+        while (day_number < max_n_days) {
+            auto prisoner_claim = NextDay();
+            if (prisoner_claim == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    int32_t n_prisoners = 0;
+    int32_t day_number = 0;
+    typename Prisoner::RoomRegister light{};
+    std::vector<Prisoner> prisoners;
+    Visitors visitors;
+    std::vector<uint8_t> prisoners_have_been_in_the_room_indicators;
+    int32_t n_prisoners_have_been_in_the_room = 0;
+    // The day on which the last prisoner first entered the room, or 0 before that.
+    int32_t all_visited_day_number = 0;
+
+private:
+    std::uniform_int_distribution<int32_t> distribution_;
+};
+
+class DedicatedCounterPrisoner : public PrisonerBase {
+public:
+    using PrisonerBase::PrisonerBase;
+
+    PrisonerClaim TakeAction(PrisonerInput input) override {
+        if (prisoner_id == 0) {
+            if (input.light->IsOn()) {
+                input.light->TurnOff();
+                ++times_turned_off_the_light;
+            }
+            if (times_turned_off_the_light == n_prisoners - 1) {
+                return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+            }
+        } else {
+            if (not has_turned_on_the_light and input.light->IsOff()) {
+                input.light->TurnOn();
+                has_turned_on_the_light = true;
+            }
+        }
+        return PrisonerClaim::claim_nothing;
+    }
+
+    bool has_turned_on_the_light = false;
+    int32_t times_turned_off_the_light = 0;
+};
+
+class DynamicCounterPrisoner : public PrisonerBase {
+public:
+    DynamicCounterPrisoner(int32_t prisoner_id, int32_t n_prisoners)
+        : DynamicCounterPrisoner{prisoner_id, n_prisoners,
+                                 ComputeDefaultSnowballStageLength(n_prisoners)} {
+    }
+
+    DynamicCounterPrisoner(int32_t prisoner_id, int32_t n_prisoners, int32_t snowball_stage_length)
+        : PrisonerBase{prisoner_id, n_prisoners},
+          snowball_stage_length{std::max(1, snowball_stage_length)} {
+    }
+
+    static int32_t ComputeDefaultSnowballStageLength(int32_t n_prisoners) {
+        // The snowball survives k days with probability of about exp(-k^2 / 2n),
+        // so after 4 sqrt(n) days it is almost surely broken.
+        return static_cast<int32_t>(std::ceil(4 * std::sqrt(n_prisoners)));
+    }
+
+    void BecomeCounter(PrisonerInput input, int32_t n_prisoners_in_the_snowball) {
+        input.light->TurnOff();
+        is_counter = true;
+        n_counted_prisoners = n_prisoners_in_the_snowball;
+    }
+
+    // While the light stays on, every day has been visited by a new prisoner. The first
+    // prisoner to come back breaks the snowball and becomes the counter, already knowing
+    // that all the prisoners of the previous days have been in the room. A snowball of every
+    // prisoner makes its last prisoner the counter, with nothing left to count.
+    void TakeSnowballStageAction(PrisonerInput input) {
+        auto is_first_visit = not has_been_in_the_room;
+        has_been_in_the_room = true;
+
+        if (input.day_number == 0) {
+            input.light->TurnOn();
+            is_counted = true;
+        } else if (input.light->IsOff()) {
+            return;
+        } else if (is_first_visit) {
+            is_counted = true;
+        } else {
+            BecomeCounter(input, input.day_number);
+            return;
+        }
+
+        if (input.day_number + 1 == n_prisoners or input.day_number == snowball_stage_length - 1) {
+            BecomeCounter(input, input.day_number + 1);
+        }
+    }
+
+    void TakeCountingStageAction(PrisonerInput input) {
+        if (is_counter) {
+            if (input.light->IsOn()) {
+                input.light->TurnOff();
+                ++n_counted_prisoners;
+            }
+        } else if (not is_counted and input.light->IsOff()) {
+            input.light->TurnOn();
+            is_counted = true;
+        }
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) override {
+        if (input.day_number < snowball_stage_length) {
+            TakeSnowballStageAction(input);
+        } else {
+            TakeCountingStageAction(input);
+        }
+
+        if (is_counter and n_counted_prisoners == n_prisoners) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        } else {
+            return PrisonerClaim::claim_nothing;
+        }
+    }
+
+    int32_t snowball_stage_length = 0;
+    bool has_been_in_the_room = false;
+    bool is_counted = false;
+    bool is_counter = false;
+    int32_t n_counted_prisoners = 0;
+};
+
+struct StageScheduleShape {
+    // Target probability of every stage of the first cycle, unless given per stage.
+    double stage_probability = 0.95;
+    std::vector<double> stage_probabilities{};
+    // The second cycle's stages are the first cycle's ones times the multiplier, and every
+    // following cycle's stages are the previous cycle's ones times the ratio.
+    double after_first_cycle_stage_length_multiplier = 0.5;
+    double per_cycle_stage_length_ratio = 1;
+    // Stage lengths of the first cycles, replacing the computed ones.
+    std::vector<std::vector<int32_t>> explicit_cycle_stage_lengths{};
+    // Zero for the cycles to go on forever, otherwise the schedule is over after that many.
+    int32_t max_n_cycles = 0;
+
+    bool operator==(const StageScheduleShape &) const = default;
+};
+
+// Stage lookups find the cycle of the day among the few cycle starts, and then its bucket: the
+// days of every cycle are split into buckets no longer than the cycle's shortest stage, so every
+// bucket holds at most one stage boundary. Cycles that grow don't make the buckets shrink.
+class StageSchedule {
+public:
+    static constexpr int32_t kMaxNPrecomputedCycles = 64;
+    static constexpr int64_t kMaxNPrecomputedDays = 1 << 30;
+
+    StageSchedule() = default;
+
+    // The last cycle repeats forever, unless repeat_last_cycle is false, in which case the
+    // schedule is over after the given cycles.
+    explicit StageSchedule(const std::vector<std::vector<int32_t>> &cycle_stage_lengths,
+                           bool repeat_last_cycle = true)
+        : repeats_last_cycle{repeat_last_cycle} {
+        if (not cycle_stage_lengths.empty()) {
+            n_stages = static_cast<int32_t>(cycle_stage_lengths.front().size());
+        }
+
+        struct Stage {
+            int32_t start_day = 0;
+            int32_t stage_index = 0;
+        };
+        std::vector<Stage> stages;
+        std::vector<int32_t> min_stage_lengths;
+        int64_t n_days = 0;
+        for (const auto &stage_lengths : cycle_stage_lengths) {
+            if (static_cast<int32_t>(stage_lengths.size()) != n_stages) {
+                throw std::invalid_argument{"Cycles must have the same number of stages."};
+            }
+            last_cycle_start_day = static_cast<int32_t>(n_days);
+            auto &min_stage_length =
+                min_stage_lengths.emplace_back(std::numeric_limits<int32_t>::max());
+            for (int32_t i = 0; i < n_stages; ++i) {
+                if (stage_lengths[i] < 0) {
+                    throw std::invalid_argument{"Stage lengths must not be negative."};
+                }
+                if (stage_lengths[i] > 0) {
+                    stages.push_back({static_cast<int32_t>(n_days), i});
+                    n_days += stage_lengths[i];
+                    min_stage_length = std::min(min_stage_length, stage_lengths[i]);
+                }
+            }
+            if (n_days > kMaxNPrecomputedDays) {
+                throw std::invalid_argument{"Schedule is too long."};
+            }
+        }
+        n_scheduled_days = static_cast<int32_t>(n_days);
+        if (repeats_last_cycle and n_stages > 0 and n_scheduled_days == last_cycle_start_day) {
+            throw std::invalid_argument{"Repeating cycle must not be empty."};
+        }
+        if (stages.empty()) {
+            return;
+        }
+
+        size_t stage = 0;
+        int32_t cycle_start_day = 0;
+        for (size_t cycle_index = 0; cycle_index < cycle_stage_lengths.size(); ++cycle_index) {
+            const auto &stage_lengths = cycle_stage_lengths[cycle_index];
+            auto cycle_end_day = cycle_start_day + std::reduce(stage_lengths.begin(),
+                                                               stage_lengths.end(), int32_t{0});
+            // Lookups of days in an empty cycle find the cycle after it.
+            if (cycle_end_day == cycle_start_day) {
+                continue;
+            }
+            auto &cycle = cycles.emplace_back(
+                Cycle{cycle_start_day, 0, static_cast<int32_t>(buckets.size())});
+            while (int32_t{2} << cycle.bucket_day_shift <= min_stage_lengths[cycle_index]) {
+                ++cycle.bucket_day_shift;
+            }
+            for (int64_t day = cycle_start_day; day < cycle_end_day;
+                 day += int64_t{1} << cycle.bucket_day_shift) {
+                while (stage + 1 < stages.size() and stages[stage + 1].start_day <= day) {
+                    ++stage;
+                }
+                if (stage + 1 < stages.size()) {
+                    buckets.push_back({stages[stage].stage_index, stages[stage + 1].start_day,
+                                       stages[stage + 1].stage_index});
+                } else {
+                    buckets.push_back({stages[stage].stage_index, n_scheduled_days,
+                                       stages[stage].stage_index});
+                }
+            }
+            cycle_start_day = cycle_end_day;
+        }
+    }
+
+    static StageSchedule Build(const std::vector<int32_t> &n_prisoners_to_visit_at_stages,
+                               int32_t n_prisoners, const StageScheduleShape &shape) {
+        auto n_stages = static_cast<int32_t>(n_prisoners_to_visit_at_stages.size());
+        auto cycles = shape.explicit_cycle_stage_lengths;
+        for (const auto &stage_lengths : cycles) {
+            if (static_cast<int32_t>(stage_lengths.size()) != n_stages) {
+                throw std::invalid_argument{"Expected a length for every stage."};
+            }
+        }
+        if (cycles.empty()) {
+            if (not shape.stage_probabilities.empty() and
+                static_cast<int32_t>(shape.stage_probabilities.size()) != n_stages) {
+                throw std::invalid_argument{"Expected a probability for every stage."};
+            }
+            std::vector<int32_t> first_cycle_stage_lengths;
+            std::vector<int32_t> after_first_cycle_stage_lengths;
+            for (int32_t i = 0; i < n_stages; ++i) {
+                auto stage_probability = shape.stage_probabilities.empty()
+                                             ? shape.stage_probability
+                                             : shape.stage_probabilities[i];
+                auto stage_length =
+                    ComputeNumberOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+                        n_prisoners_to_visit_at_stages[i], stage_probability, n_prisoners);
+                first_cycle_stage_lengths.push_back(stage_length);
+                after_first_cycle_stage_lengths.push_back(std::max(
+                    1, static_cast<int32_t>(stage_length *
+                                            shape.after_first_cycle_stage_length_multiplier)));
+            }
+            cycles = {first_cycle_stage_lengths, after_first_cycle_stage_lengths};
+        }
+
+        int64_t n_days = 0;
+        for (const auto &stage_lengths : cycles) {
+            n_days += std::reduce(stage_lengths.begin(), stage_lengths.end(), int64_t{0});
+        }
+        auto n_cycles_to_precompute = static_cast<size_t>(
+            shape.max_n_cycles > 0                        ? shape.max_n_cycles
+            : shape.per_cycle_stage_length_ratio == 1 ? static_cast<int32_t>(cycles.size())
+                                                          : kMaxNPrecomputedCycles);
+        while (cycles.size() < n_cycles_to_precompute) {
+            std::vector<int32_t> stage_lengths;
+            int64_t n_cycle_days = 0;
+            for (auto previous_stage_length : cycles.back()) {
+                stage_lengths.push_back(std::max(
+                    1, static_cast<int32_t>(std::min<double>(
+                           previous_stage_length * shape.per_cycle_stage_length_ratio,
+                           kMaxNPrecomputedDays))));
+                n_cycle_days += stage_lengths.back();
+            }
+            if (n_days + n_cycle_days > kMaxNPrecomputedDays) {
+                if (shape.max_n_cycles > 0) {
+                    throw std::invalid_argument{"Schedule is too long."};
+                }
+                break;
+            }
+            n_days += n_cycle_days;
+            cycles.push_back(std::move(stage_lengths));
+        }
+        if (shape.max_n_cycles > 0) {
+            cycles.resize(std::min(cycles.size(), n_cycles_to_precompute));
+        }
+
+        return StageSchedule{cycles, shape.max_n_cycles == 0};
+    }
+
+    // All the prisoners of a prison ask for the same schedule one after another, so the last
+    // schedule built on this thread for a given call site is shared between them.
+    template <class Key, class MakeSchedule>
+    static std::shared_ptr<const StageSchedule> GetShared(const Key &key,
+                                                          MakeSchedule make_schedule) {
+        thread_local std::optional<Key> last_key;
+        thread_local std::shared_ptr<const StageSchedule> last_schedule;
+        if (not last_key or not(*last_key == key)) {
+            auto start = std::chrono::steady_clock::now();
+            last_schedule = std::make_shared<const StageSchedule>(make_schedule());
+            last_key = key;
+            report::GetScheduleBuildNanoseconds() +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+        }
+        return last_schedule;
+    }
+
+    // Beyond this term the inclusion-exclusion sum cancels catastrophically.
+    static constexpr double kMaxExactTerm = 1.0e6;
+
+    using DaysKey = std::tuple<int32_t, double, int32_t>;
+
+    using DaysSolutions = std::vector<std::pair<DaysKey, int32_t>>;
+
+    // Solutions of the last run of the batch solver, sorted by key, for every thread. Each run
+    // replaces those of the run before, so they take no more memory than the largest batch, and
+    // lookups only hold the mutex to copy the pointer.
+    struct LastBatchDays {
+        std::mutex mutex;
+        std::shared_ptr<const DaysSolutions> days;
+    };
+
+    static LastBatchDays &GetLastBatchDays() {
+        static LastBatchDays last_batch_days;
+        return last_batch_days;
+    }
+
+    // The least positive number of days with at least the target probability, searched by
+    // galloping from initial_days in the direction of the solution and then bisecting.
+    static int32_t SearchNumberOfDays(int32_t k_prisoners, double target_probability,
+                                      int32_t n_prisoners, int32_t initial_days,
+                                      std::span<const double> log_factorials = {}) {
+        auto is_enough = [&](int64_t n_days) {
+            return ComputeProbabilityThatKFixedPrisonersWereInTheRoomDuringNDays(
+                       k_prisoners, static_cast<int32_t>(n_days), n_prisoners,
+                       log_factorials) >= target_probability;
+        };
+
+        // Keeps low not enough, or 0, and high enough.
+        int64_t low = 0;
+        int64_t high = std::max(1, initial_days);
+        int64_t step = 1;
+        if (is_enough(high)) {
+            while (high - step >= 1 and is_enough(high - step)) {
+                high -= step;
+                step *= 2;
+            }
+            low = std::max<int64_t>(0, high - step);
+        } else {
+            low = high;
+            while (not is_enough(low + step)) {
+                low += step;
+                step *= 2;
+                if (low + step > std::numeric_limits<int32_t>::max()) {
+                    throw std::runtime_error{"Number of days is out of range."};
+                }
+            }
+            high = low + step;
+        }
+        while (high - low > 1) {
+            auto mid = low + (high - low) / 2;
+            if (is_enough(mid)) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        return static_cast<int32_t>(high);
+    }
+
+    template <class T>
+    static T NChooseK(T n, T k) {
+        if (n < k) {
+            return 0;
+        }
+        k = std::min(k, n - k);
+        T result = 1;
+        for (int i = 1; i <= k; i++) {
+            result = result * (n - k + i) / i;
+        }
+        return result;
+    }
+
+    static double LogNChooseK(int32_t n, int32_t k) {
+        return std::lgamma(n + 1.0) - std::lgamma(k + 1.0) - std::lgamma(n - k + 1.0);
+    }
+
+    // log_factorials[i] = lgamma(i + 1), if it holds k_prisoners + 1 values, saves the lgamma
+    // calls of the binomials.
+    static double ComputeProbabilityThatKFixedPrisonersWereInTheRoomDuringNDays(
+        int32_t k_prisoners, int32_t n_days, int32_t n_prisoners,
+        std::span<const double> log_factorials = {}) {
+        if (n_days < k_prisoners or n_prisoners < k_prisoners) {
+            return 0;
+        }
+
+        auto has_log_factorials = static_cast<int32_t>(log_factorials.size()) > k_prisoners;
+        double result = 0;
+        double max_term = 0;
+        for (int32_t i = 0; i <= k_prisoners; i++) {
+            auto log_n_choose_k =
+                has_log_factorials ? log_factorials[k_prisoners] - log_factorials[i] -
+                                         log_factorials[k_prisoners - i]
+                                   : LogNChooseK(k_prisoners, i);
+            auto term = std::exp(log_n_choose_k +
+                                 n_days * std::log1p(static_cast<double>(-i) / n_prisoners));
+            // The terms are log-concave in i, so once they decrease they keep decreasing, and
+            // the rest of the alternating sum is smaller than the current term.
+            if (term < max_term and term < 1.0e-18) {
+                break;
+            }
+            max_term = std::max(max_term, term);
+            result += i % 2 == 0 ? term : -term;
+            if (max_term > kMaxExactTerm) {
+                break;
+            }
+        }
+
+        // With mu = k (1 - 1/n)^days the terms are bounded by exp(mu) and the probability by
+        // exp(-mu), so once the sum cancels catastrophically the probability is below
+        // 1 / max_term. Visits are negatively associated, so independent visits bound it.
+        if (max_term > kMaxExactTerm) {
+            return std::pow(-std::expm1(n_days * std::log1p(-1.0 / n_prisoners)), k_prisoners);
+        }
+
+        if (result < -1.0e-3 or result > 1 + 1.0e-9) {
+            throw std::runtime_error("Unstable probability calculation.");
+        }
+
+        return std::clamp(result, 0.0, 1.0);
+    }
+
+    static int32_t ComputeNumberOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+        int32_t k_prisoners, double target_probability, int32_t n_prisoners) {
+        if (k_prisoners > n_prisoners) {
+            throw std::invalid_argument{
+                "Requested number of prisoners is greater than total number."};
+        }
+
+        thread_local std::map<DaysKey, int32_t> cache;
+        auto key = std::make_tuple(k_prisoners, target_probability, n_prisoners);
+        if (auto it = cache.find(key); it != cache.end()) {
+            return it->second;
+        }
+        std::shared_ptr<const DaysSolutions> batch_days;
+        {
+            auto &last_batch_days = GetLastBatchDays();
+            std::lock_guard lock{last_batch_days.mutex};
+            batch_days = last_batch_days.days;
+        }
+        if (batch_days) {
+            auto it = std::lower_bound(
+                batch_days->begin(), batch_days->end(), key,
+                [](const auto &solution, const DaysKey &key) { return solution.first < key; });
+            if (it != batch_days->end() and it->first == key) {
+                return cache[key] = it->second;
+            }
+        }
+
+        return cache[key] = SearchNumberOfDays(k_prisoners, target_probability, n_prisoners, 1);
+    }
+
+    // Solves ComputeNumberOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability for every
+    // (k_prisoners, n_prisoners) pair at once, and shares the solutions with later calls of it
+    // until the next batch.
+    // Pairs with the same k are solved in order of n, each search starting from the days of
+    // the previous n, which are close, and chunks of them are spread across threads.
+    static std::vector<int32_t>
+    ComputeNumbersOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+        const std::vector<std::pair<int32_t, int32_t>> &k_and_n_prisoners,
+        double target_probability, int32_t n_threads) {
+        constexpr size_t kChunkSize = 256;
+
+        std::vector<size_t> order(k_and_n_prisoners.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return k_and_n_prisoners[a] < k_and_n_prisoners[b];
+        });
+        std::vector<std::pair<size_t, size_t>> chunks;
+        int32_t max_k_prisoners = 0;
+        for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+            auto [k_prisoners, n_prisoners] = k_and_n_prisoners[order[begin]];
+            if (k_prisoners > n_prisoners) {
+                throw std::invalid_argument{
+                    "Requested number of prisoners is greater than total number."};
+            }
+            max_k_prisoners = std::max(max_k_prisoners, k_prisoners);
+            end = begin + 1;
+            while (end < order.size() and end - begin < kChunkSize and
+                   k_and_n_prisoners[order[end]].first == k_prisoners) {
+                ++end;
+            }
+            chunks.emplace_back(begin, end);
+        }
+
+        std::vector<double> log_factorials(max_k_prisoners + 1);
+        for (int32_t i = 0; i <= max_k_prisoners; ++i) {
+            log_factorials[i] = std::lgamma(i + 1.0);
+        }
+
+        std::vector<int32_t> days(k_and_n_prisoners.size());
+        parallel::ForEachIndex(
+            static_cast<int32_t>(chunks.size()), n_threads, [&](int32_t chunk) {
+                // The days grow about linearly in n, so the search starts from the line
+                // through the previous two solutions.
+                // The first search of a chunk starts from the days for independent visits.
+                std::pair<int32_t, int64_t> previous{0, 1};
+                std::pair<int32_t, int64_t> before_previous{0, 1};
+                for (auto i = chunks[chunk].first; i < chunks[chunk].second; ++i) {
+                    auto [k_prisoners, n_prisoners] = k_and_n_prisoners[order[i]];
+                    auto initial_days = previous.second;
+                    if (previous.first == 0 and n_prisoners > 1) {
+                        initial_days = static_cast<int64_t>(
+                            std::log(-std::expm1(std::log(target_probability) / k_prisoners)) /
+                            std::log1p(-1.0 / n_prisoners));
+                    } else if (before_previous.first > 0 and
+                               previous.first > before_previous.first) {
+                        initial_days += (previous.second - before_previous.second) *
+                                        (n_prisoners - previous.first) /
+                                        (previous.first - before_previous.first);
+                    }
+                    days[order[i]] = SearchNumberOfDays(
+                        k_prisoners, target_probability, n_prisoners,
+                        static_cast<int32_t>(std::clamp<int64_t>(
+                            initial_days, 1, std::numeric_limits<int32_t>::max())),
+                        log_factorials);
+                    before_previous = previous;
+                    previous = {n_prisoners, days[order[i]]};
+                }
+            });
+
+        // In order of (k_prisoners, n_prisoners), so sorted by key.
+        auto batch_days = std::make_shared<DaysSolutions>();
+        batch_days->reserve(days.size());
+        for (auto i : order) {
+            auto [k_prisoners, n_prisoners] = k_and_n_prisoners[i];
+            batch_days->emplace_back(DaysKey{k_prisoners, target_probability, n_prisoners},
+                                     days[i]);
+        }
+        auto &last_batch_days = GetLastBatchDays();
+        std::lock_guard lock{last_batch_days.mutex};
+        last_batch_days.days = std::move(batch_days);
+        return days;
+    }
+
+    [[nodiscard]] int32_t GetNStages() const {
+        return n_stages;
+    }
+
+    // Once a schedule that does not repeat is over, the stage index is GetNStages().
+    [[nodiscard]] int32_t GetStageIndex(int32_t day_number) const {
+        if (n_stages == 0) {
+            return 0;
+        }
+        if (day_number >= n_scheduled_days) {
+            if (not repeats_last_cycle) {
+                return n_stages;
+            }
+            day_number = last_cycle_start_day + (day_number - last_cycle_start_day) %
+                                                    (n_scheduled_days - last_cycle_start_day);
+        }
+        // Days of the last cycle, where repeating schedules spend most of their days, skip
+        // the search.
+        auto cycle = std::prev(cycles.end());
+        if (day_number < cycle->start_day) {
+            cycle = std::prev(std::upper_bound(
+                cycles.begin() + 1, cycle, day_number,
+                [](int32_t day, const Cycle &cycle) { return day < cycle.start_day; }));
+        }
+        const auto &bucket =
+            buckets[cycle->first_bucket +
+                    ((day_number - cycle->start_day) >> cycle->bucket_day_shift)];
+        return day_number < bucket.next_stage_start_day ? bucket.stage_index
+                                                        : bucket.next_stage_index;
+    }
+
+    [[nodiscard]] bool IsLastDayOfTheStage(int32_t day_number) const {
+        return GetStageIndex(day_number) != GetStageIndex(day_number + 1);
+    }
+
+    [[nodiscard]] bool IsOver(int32_t day_number) const {
+        return not repeats_last_cycle and day_number >= n_scheduled_days;
+    }
+
+private:
+    struct Bucket {
+        int32_t stage_index = 0;
+        int32_t next_stage_start_day = 0;
+        int32_t next_stage_index = 0;
+    };
+
+    struct Cycle {
+        int32_t start_day = 0;
+        int32_t bucket_day_shift = 0;
+        int32_t first_bucket = 0;
+    };
+
+    int32_t n_stages = 0;
+    bool repeats_last_cycle = true;
+    int32_t n_scheduled_days = 0;
+    int32_t last_cycle_start_day = 0;
+    std::vector<Cycle> cycles;
+    std::vector<Bucket> buckets;
+};
+
+// With max_n_cycles cycles of the schedule shape, the prisoners do nothing once the schedule is
+// over, so they only run as the first phase of TokenThenCounterPrisoner.
+class TokenPrisoner : public PrisonerBase {
+public:
+    TokenPrisoner(int32_t prisoner_id, int32_t n_prisoners, double stage_probability = 0.95,
+                  double after_first_cycle_stage_length_multiplier = 0.5)
+        : TokenPrisoner{prisoner_id, n_prisoners,
+                        StageScheduleShape{.stage_probability = stage_probability,
+                                           .after_first_cycle_stage_length_multiplier =
+                                               after_first_cycle_stage_length_multiplier}} {
+    }
+
+    TokenPrisoner(int32_t prisoner_id, int32_t n_prisoners,
+                  const StageScheduleShape &schedule_shape)
+        : PrisonerBase{prisoner_id, n_prisoners} {
+
+        n_stages = GetClosestNotSmallerPowerOf2(n_prisoners);
+        auto n_prisoners_with_2_tokens_initially = (1 << n_stages) - n_prisoners;
+        n_tokens = prisoner_id < n_prisoners_with_2_tokens_initially ? 2 : 1;
+
+        schedule = StageSchedule::GetShared(std::make_tuple(n_prisoners, schedule_shape), [&] {
+            return StageSchedule::Build(GetNPrisonersToVisitAtStages(n_prisoners), n_prisoners,
+                                        schedule_shape);
+        });
+    }
+
+    static std::vector<int32_t> GetNPrisonersToVisitAtStages(int32_t n_prisoners) {
+        auto n_stages = GetClosestNotSmallerPowerOf2(n_prisoners);
+        auto n_prisoners_with_1_token_initially = 2 * n_prisoners - (1 << n_stages);
+        std::vector<int32_t> n_prisoners_to_visit_at_stages;
+        for (int i = 1; i <= n_stages; i++) {
+            if (i == 1) {
+                n_prisoners_to_visit_at_stages.push_back(n_prisoners_with_1_token_initially);
+            } else {
+                auto light_in_tokens_value_at_stage_i = 1 << (i - 1);
+                int32_t expected_number_of_prisoners_with_tokens =
+                    (1 << n_stages) / light_in_tokens_value_at_stage_i;
+                n_prisoners_to_visit_at_stages.push_back(expected_number_of_prisoners_with_tokens);
+            }
+        }
+        return n_prisoners_to_visit_at_stages;
+    }
+
+    static int32_t GetClosestNotSmallerPowerOf2(int32_t number) {
+        return std::ceil(log2(number));
+    }
+
+    [[nodiscard]] bool IsCounter() const {
+        return prisoner_id == 0;
+    }
+
+    void MaybeTurnOffLight(PrisonerInput input) {
+        if (input.light->IsOff()) {
+            return;
+        }
+        if (schedule->IsOver(input.day_number)) {
+            return;
+        }
+        auto stage_index = schedule->GetStageIndex(input.day_number);
+        auto light_in_tokens_value = 1 << stage_index;
+        bool have_matching_bit = n_tokens & light_in_tokens_value;
+        if (schedule->IsLastDayOfTheStage(input.day_number) or have_matching_bit) {
+            n_tokens += light_in_tokens_value;
+            input.light->TurnOff();
+        }
+    }
+
+    void MaybeTurnOnLight(PrisonerInput input) {
+        if (input.light->IsOn()) {
+            return;
+        }
+        if (schedule->IsOver(input.day_number + 1)) {
+            return;
+        }
+        auto next_day_stage_index = schedule->GetStageIndex(input.day_number + 1);
+        auto next_day_light_in_tokens_value = 1 << next_day_stage_index;
+        auto have_matching_bit = n_tokens & next_day_light_in_tokens_value;
+        if (have_matching_bit) {
+            n_tokens -= next_day_light_in_tokens_value;
+            input.light->TurnOn();
+        }
+    }
+
+    [[nodiscard]] bool ShouldClaimThatEveryoneHasBeenInTheRoom() const {
+        return n_tokens == 1 << GetClosestNotSmallerPowerOf2(n_prisoners);
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) override {
+        if (n_prisoners == 1) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        }
+
+        MaybeTurnOffLight(input);
+        MaybeTurnOnLight(input);
+
+        if (ShouldClaimThatEveryoneHasBeenInTheRoom()) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        } else {
+            return PrisonerClaim::claim_nothing;
+        }
+    }
+
+    int32_t n_tokens = 0;
+    int32_t n_stages = 0;
+    std::shared_ptr<const StageSchedule> schedule;
+};
+
+// A prisoner that goes through Phases in order. The first phase is constructed from the
+// prisoner's id, the number of prisoners and prisoner_args, every later one from the phase
+// before it, on the prisoner's first visit after that phase IsOver(day_number). Phases end on
+// a common day, so every prisoner switches at its own first visit after it, and the light
+// must mean the same to both sides of a switch. Phases are plain classes dispatched at
+// compile time, so only TakeAction itself is virtual.
+template <class... Phases>
+class PhasedPrisoner : public PrisonerBase {
+public:
+    template <class... PrisonerArgs>
+    PhasedPrisoner(int32_t prisoner_id, int32_t n_prisoners, const PrisonerArgs &...prisoner_args)
+        : PrisonerBase{prisoner_id, n_prisoners},
+          phases{std::in_place_index<0>, prisoner_id, n_prisoners, prisoner_args...} {
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) override {
+        return TakeActionInPhase<0>(input);
+    }
+
+    [[nodiscard]] size_t GetPhaseIndex() const {
+        return phases.index();
+    }
+
+private:
+    template <size_t phase_index>
+    PrisonerClaim TakeActionInPhase(PrisonerInput input) {
+        if constexpr (phase_index + 1 < sizeof...(Phases)) {
+            if (phases.index() != phase_index) {
+                return TakeActionInPhase<phase_index + 1>(input);
+            }
+            auto &phase = *std::get_if<phase_index>(&phases);
+            if (not phase.IsOver(input.day_number)) {
+                return phase.TakeAction(input);
+            }
+            auto finished_phase = std::move(phase);
+            phases.template emplace<phase_index + 1>(finished_phase);
+            return TakeActionInPhase<phase_index + 1>(input);
+        } else {
+            return std::get_if<phase_index>(&phases)->TakeAction(input);
+        }
+    }
+
+    std::variant<Phases...> phases;
+};
+
+// TokenPrisoner's token merging for a bounded number of schedule cycles. The last scheduled
+// day takes the light off, so it is off after it.
+class TokenCyclesPhase {
+public:
+    static constexpr int32_t kDefaultNCycles = 8;
+
+    TokenCyclesPhase(int32_t prisoner_id, int32_t n_prisoners, int32_t n_cycles = kDefaultNCycles)
+        : TokenCyclesPhase{prisoner_id, n_prisoners, MakeScheduleShape(n_cycles)} {
+    }
+
+    TokenCyclesPhase(int32_t prisoner_id, int32_t n_prisoners,
+                     const StageScheduleShape &schedule_shape)
+        : token_prisoner{prisoner_id, n_prisoners, schedule_shape} {
+        assert(schedule_shape.max_n_cycles > 0);
+    }
+
+    // The default schedule shape, over after n_cycles cycles.
+    static StageScheduleShape MakeScheduleShape(int32_t n_cycles) {
+        StageScheduleShape schedule_shape;
+        schedule_shape.max_n_cycles = n_cycles;
+        return schedule_shape;
+    }
+
+    [[nodiscard]] bool IsOver(int32_t day_number) const {
+        return token_prisoner.schedule->IsOver(day_number);
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) {
+        return token_prisoner.TokenPrisoner::TakeAction(input);
+    }
+
+    TokenPrisoner token_prisoner;
+};
+
+// A dedicated counter over the tokens left from token merging: prisoner 0 takes the tokens
+// from the light, everyone else puts theirs there one at a time.
+class TokenCounterPhase {
+public:
+    explicit TokenCounterPhase(const TokenCyclesPhase &token_cycles)
+        : prisoner_id{token_cycles.token_prisoner.prisoner_id},
+          n_tokens{token_cycles.token_prisoner.n_tokens},
+          n_all_tokens{1 << token_cycles.token_prisoner.n_stages} {
+    }
+
+    [[nodiscard]] bool IsOver(int32_t) const {
+        return false;
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) {
+        if (prisoner_id == 0) {
+            if (input.light->IsOn()) {
+                input.light->TurnOff();
+                ++n_tokens;
+            }
+            if (n_tokens == n_all_tokens) {
+                return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+            }
+        } else if (input.light->IsOff() and n_tokens > 0) {
+            input.light->TurnOn();
+            --n_tokens;
+        }
+        return PrisonerClaim::claim_nothing;
+    }
+
+    int32_t prisoner_id = 0;
+    int32_t n_tokens = 0;
+    int32_t n_all_tokens = 0;
+};
+
+// Merges tokens for n_cycles schedule cycles, which mostly succeeds quickly, and then counts
+// whatever is left one token at a time, which can't fail. This is the only implementation of
+// TokenPrisoner with a bounded number of cycles.
+using TokenThenCounterPrisoner = PhasedPrisoner<TokenCyclesPhase, TokenCounterPhase>;
+
+// TokenPrisoner over a register with n_states states: stage i moves the i-th base n_states
+// digit of the tokens, so every visit moves log2(n_states) bits. Visitors always take what
+// is in the register and put back their digit of the next day's stage, so tokens merge
+// when a digit overflows. With two states this is exactly TokenPrisoner.
+template <int32_t n_states>
+class RegisterTokenPrisoner : public BasicPrisonerBase<Register<n_states>> {
+public:
+    using Input = BasicPrisonerInput<Register<n_states>>;
+
+    RegisterTokenPrisoner(int32_t prisoner_id, int32_t n_prisoners,
+                          double stage_probability = 0.95,
+                          double after_first_cycle_stage_length_multiplier = 0.5)
+        : RegisterTokenPrisoner{prisoner_id, n_prisoners,
+                                StageScheduleShape{.stage_probability = stage_probability,
+                                                   .after_first_cycle_stage_length_multiplier =
+                                                       after_first_cycle_stage_length_multiplier}} {
+    }
+
+    RegisterTokenPrisoner(int32_t prisoner_id, int32_t n_prisoners,
+                          const StageScheduleShape &schedule_shape)
+        : BasicPrisonerBase<Register<n_states>>{prisoner_id, n_prisoners} {
+
+        n_tokens_in_total = 1;
+        while (n_tokens_in_total < n_prisoners) {
+            n_tokens_in_total *= n_states;
+            digit_values.push_back(n_tokens_in_total / n_states);
+        }
+        n_tokens = n_tokens_in_total / n_prisoners +
+                   (prisoner_id < n_tokens_in_total % n_prisoners ? 1 : 0);
+
+        schedule = StageSchedule::GetShared(std::make_tuple(n_prisoners, schedule_shape), [&] {
+            std::vector<int32_t> n_prisoners_to_visit_at_stages;
+            for (auto digit_value : digit_values) {
+                n_prisoners_to_visit_at_stages.push_back(static_cast<int32_t>(
+                    std::min<int64_t>(n_tokens_in_total / digit_value, n_prisoners)));
+            }
+            return StageSchedule::Build(n_prisoners_to_visit_at_stages, n_prisoners,
+                                        schedule_shape);
+        });
+    }
+
+    [[nodiscard]] int32_t GetDigit(int32_t stage_index) const {
+        return static_cast<int32_t>(n_tokens / digit_values[stage_index] % n_states);
+    }
+
+    // Once the schedule is over, prisoner 0 collects single tokens, as many as the register
+    // holds at a time.
+    void TakeCountingStageAction(Input input) {
+        if (this->prisoner_id == 0) {
+            n_tokens += input.light->GetState();
+            input.light->SetState(0);
+        } else if (input.light->GetState() == 0) {
+            auto n_tokens_to_leave =
+                static_cast<int32_t>(std::min<int64_t>(n_tokens, n_states - 1));
+            n_tokens -= n_tokens_to_leave;
+            input.light->SetState(n_tokens_to_leave);
+        }
+    }
+
+    PrisonerClaim TakeAction(Input input) override {
+        if (digit_values.empty()) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        }
+
+        if (schedule->IsOver(input.day_number)) {
+            TakeCountingStageAction(input);
+        } else {
+            auto stage_index = schedule->GetStageIndex(input.day_number);
+            n_tokens += input.light->GetState() * digit_values[stage_index];
+            input.light->SetState(0);
+        }
+
+        if (schedule->IsOver(input.day_number + 1)) {
+            if (this->prisoner_id != 0 and input.light->GetState() == 0) {
+                TakeCountingStageAction(input);
+            }
+        } else {
+            auto next_day_stage_index = schedule->GetStageIndex(input.day_number + 1);
+            auto next_day_digit = GetDigit(next_day_stage_index);
+            n_tokens -= next_day_digit * digit_values[next_day_stage_index];
+            input.light->SetState(next_day_digit);
+        }
+
+        if (n_tokens == n_tokens_in_total) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        } else {
+            return PrisonerClaim::claim_nothing;
+        }
+    }
+
+    int64_t n_tokens = 0;
+    int64_t n_tokens_in_total = 0;
+    std::vector<int64_t> digit_values;
+    std::shared_ptr<const StageSchedule> schedule;
+};
+
+// Assistant counters of level l gather a quota of units of level l - 1 and hand them over
+// as a single unit of level l, so the light carries a unit of the level of the current
+// stage. Prisoner 0 is the head counter: it keeps what is left over at every level after
+// the assistants' quotas, so that supply and demand of units match exactly at every level.
+class HierarchicalCounterPrisoner : public PrisonerBase {
+public:
+    HierarchicalCounterPrisoner(int32_t prisoner_id, int32_t n_prisoners)
+        : HierarchicalCounterPrisoner{prisoner_id, n_prisoners,
+                                      ComputeDefaultQuotas(n_prisoners, 2)} {
+    }
+
+    HierarchicalCounterPrisoner(int32_t prisoner_id, int32_t n_prisoners,
+                                const std::vector<int32_t> &quotas,
+                                double stage_probability = 0.95,
+                                double after_first_cycle_stage_length_multiplier = 0.5)
+        : PrisonerBase{prisoner_id, n_prisoners} {
+
+        auto n_stages = static_cast<int32_t>(quotas.size()) + 1;
+        unit_values.push_back(1);
+        std::vector<int32_t> n_units_at_level{n_prisoners};
+        auto first_prisoner_id_at_level = 1;
+        for (int32_t level = 1; level < n_stages; ++level) {
+            auto quota = quotas[level - 1];
+            if (quota < 2) {
+                throw std::invalid_argument{"Assistant counter quotas must be at least 2."};
+            }
+            auto n_assistants = n_units_at_level.back() / quota;
+            head_quotas.push_back(n_units_at_level.back() - n_assistants * quota);
+            if (first_prisoner_id_at_level <= prisoner_id and
+                prisoner_id < first_prisoner_id_at_level + n_assistants) {
+                counter_level = level;
+                this->quota = quota;
+            }
+            first_prisoner_id_at_level += n_assistants;
+            unit_values.push_back(unit_values.back() * quota);
+            n_units_at_level.push_back(n_assistants);
+        }
+        head_quotas.push_back(n_units_at_level.back());
+        if (prisoner_id == 0) {
+            counter_level = n_stages;
+        }
+
+        n_units.resize(n_stages);
+        n_units[0] = 1;
+
+        auto schedule_shape = StageScheduleShape{
+            .stage_probability = stage_probability,
+            .after_first_cycle_stage_length_multiplier = after_first_cycle_stage_length_multiplier};
+        auto schedule_key = std::make_tuple(n_prisoners, quotas, schedule_shape);
+        schedule = StageSchedule::GetShared(schedule_key, [&] {
+            std::vector<int32_t> n_prisoners_to_visit_at_stages;
+            for (auto n_units_to_hand_over : n_units_at_level) {
+                n_prisoners_to_visit_at_stages.push_back(
+                    std::min(n_units_to_hand_over, n_prisoners));
+            }
+            return StageSchedule::Build(n_prisoners_to_visit_at_stages, n_prisoners,
+                                        schedule_shape);
+        });
+    }
+
+    static std::vector<int32_t> ComputeDefaultQuotas(int32_t n_prisoners, int32_t n_levels) {
+        auto quota = static_cast<int32_t>(std::round(std::pow(n_prisoners, 1.0 / n_levels)));
+        return std::vector<int32_t>(n_levels - 1, std::max(2, quota));
+    }
+
+    [[nodiscard]] bool IsHeadCounter() const {
+        return counter_level == static_cast<int32_t>(n_units.size());
+    }
+
+    [[nodiscard]] int32_t GetNUnitsToKeep(int32_t level) const {
+        if (IsHeadCounter()) {
+            return head_quotas[level];
+        } else if (counter_level == level + 1 and not has_gathered_quota) {
+            return quota;
+        } else {
+            return 0;
+        }
+    }
+
+    void MaybeTurnOffLight(PrisonerInput input) {
+        if (input.light->IsOff()) {
+            return;
+        }
+        auto level = schedule->GetStageIndex(input.day_number);
+        if (n_units[level] < GetNUnitsToKeep(level) or
+            schedule->IsLastDayOfTheStage(input.day_number)) {
+            ++n_units[level];
+            input.light->TurnOff();
+        }
+        if (not IsHeadCounter() and counter_level == level + 1 and not has_gathered_quota and
+            n_units[level] >= quota) {
+            n_units[level] -= quota;
+            ++n_units[counter_level];
+            has_gathered_quota = true;
+        }
+    }
+
+    void MaybeTurnOnLight(PrisonerInput input) {
+        if (input.light->IsOn()) {
+            return;
+        }
+        auto next_day_level = schedule->GetStageIndex(input.day_number + 1);
+        if (n_units[next_day_level] > GetNUnitsToKeep(next_day_level)) {
+            --n_units[next_day_level];
+            input.light->TurnOn();
+        }
+    }
+
+    [[nodiscard]] bool ShouldClaimThatEveryoneHasBeenInTheRoom() const {
+        return IsHeadCounter() and std::inner_product(n_units.begin(), n_units.end(),
+                                                      unit_values.begin(), 0) == n_prisoners;
+    }
+
+    PrisonerClaim TakeAction(PrisonerInput input) override {
+        MaybeTurnOffLight(input);
+        MaybeTurnOnLight(input);
+
+        if (ShouldClaimThatEveryoneHasBeenInTheRoom()) {
+            return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        } else {
+            return PrisonerClaim::claim_nothing;
+        }
+    }
+
+    int32_t counter_level = 0;
+    int32_t quota = 0;
+    bool has_gathered_quota = false;
+    std::vector<int32_t> n_units;
+    std::vector<int32_t> unit_values;
+    std::vector<int32_t> head_quotas;
+    std::shared_ptr<const StageSchedule> schedule;
+};
+
+// A finite-state strategy: every visit maps (role, local state, light, day phase) to
+// (new local state, light, claim), the day phase being the day number modulo n_day_phases.
+// The first role_sizes[0] prisoners have role 0 and so on, the remaining prisoners having
+// the last role. Every prisoner starts in state 0, and unset transitions change nothing.
+class StrategyTable {
+public:
+    struct Transition {
+        uint16_t next_state = 0;
+        uint8_t light_is_on = 0;
+        uint8_t claim = 0;
+
+        bool operator==(const Transition &) const = default;
+    };
+
+    static constexpr int32_t kMaxNStates = std::numeric_limits<uint16_t>::max() + 1;
+    // TablePrison keeps the role of every prisoner in a byte.
+    static constexpr int32_t kMaxNRoles = std::numeric_limits<uint8_t>::max() + 1;
+
+    StrategyTable(int32_t n_roles, int32_t n_states, int32_t n_day_phases,
+                  std::vector<int32_t> role_sizes)
+        : n_roles{n_roles},
+          n_states{n_states},
+          n_day_phases{n_day_phases},
+          role_sizes{std::move(role_sizes)} {
+        if (n_roles < 1 or n_roles > kMaxNRoles or n_states < 1 or n_states > kMaxNStates or
+            n_day_phases < 1) {
+            throw std::invalid_argument{"Invalid strategy table dimensions."};
+        }
+        if (static_cast<int32_t>(this->role_sizes.size()) != n_roles - 1) {
+            throw std::invalid_argument{"Expected sizes of all roles but the last one."};
+        }
+        if (std::ranges::any_of(this->role_sizes, [](int32_t size) { return size < 0; })) {
+            throw std::invalid_argument{"Role sizes must not be negative."};
+        }
+        transitions.resize(static_cast<size_t>(n_roles) * n_states * 2 * n_day_phases);
+        for (int32_t role = 0; role < n_roles; ++role) {
+            for (int32_t state = 0; state < n_states; ++state) {
+                for (int32_t light_is_on = 0; light_is_on < 2; ++light_is_on) {
+                    for (int32_t day_phase = 0; day_phase < n_day_phases; ++day_phase) {
+                        At(role, state, light_is_on, day_phase) = {
+                            static_cast<uint16_t>(state), static_cast<uint8_t>(light_is_on), 0};
+                    }
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] size_t GetTransitionIndex(int32_t role, int32_t state, int32_t light_is_on,
+                                            int32_t day_phase) const {
+        return ((static_cast<size_t>(role) * n_states + state) * 2 + light_is_on) * n_day_phases +
+               day_phase;
+    }
+
+    Transition &At(int32_t role, int32_t state, int32_t light_is_on, int32_t day_phase) {
+        return transitions[GetTransitionIndex(role, state, light_is_on, day_phase)];
+    }
+
+    [[nodiscard]] const Transition &At(int32_t role, int32_t state, int32_t light_is_on,
+                                       int32_t day_phase) const {
+        return transitions[GetTransitionIndex(role, state, light_is_on, day_phase)];
+    }
+
+    [[nodiscard]] int32_t GetRole(int32_t prisoner_id) const {
+        for (int32_t role = 0; role < n_roles - 1; ++role) {
+            prisoner_id -= role_sizes[role];
+            if (prisoner_id < 0) {
+                return role;
+            }
+        }
+        return n_roles - 1;
+    }
+
+    // The text format is a header of "roles", "states", "phases" and "role_sizes" lines,
+    // followed by "role state light phase next_state next_light claim" transition lines.
+    // A "*" matches any role, state, light or phase, and "=" keeps the state or the light.
+    // Later lines override earlier ones, "#" starts a comment, and an "end" line ends the
+    // table, so that several tables can follow each other in a stream.
+    static StrategyTable Parse(std::istream &input) {
+        int32_t n_roles = 1;
+        int32_t n_states = 1;
+        int32_t n_day_phases = 1;
+        std::vector<int32_t> role_sizes;
+        std::optional<StrategyTable> table;
+
+        auto parse_range = [](const std::string &token, int32_t size) {
+            if (token == "*") {
+                return std::make_pair(0, size);
+            }
+            auto value = std::stoi(token);
+            if (value < 0 or value >= size) {
+                throw std::invalid_argument{"Strategy table value out of range: " + token};
+            }
+            return std::make_pair(value, value + 1);
+        };
+
+        std::string line;
+        while (std::getline(input, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream iss{line};
+            std::vector<std::string> tokens;
+            for (std::string token; iss >> token;) {
+                tokens.push_back(token);
+            }
+            if (tokens.empty()) {
+                continue;
+            }
+            if (tokens[0] == "end") {
+                break;
+            }
+
+            if (tokens[0] == "roles" or tokens[0] == "states" or tokens[0] == "phases" or
+                tokens[0] == "role_sizes") {
+                if (table) {
+                    throw std::invalid_argument{"Strategy table header after transitions."};
+                }
+                if (tokens[0] == "role_sizes") {
+                    role_sizes.clear();
+                    for (size_t i = 1; i < tokens.size(); ++i) {
+                        role_sizes.push_back(std::stoi(tokens[i]));
+                    }
+                } else if (tokens.size() != 2) {
+                    throw std::invalid_argument{"Expected a single value: " + line};
+                } else {
+                    auto value = std::stoi(tokens[1]);
+                    (tokens[0] == "roles"    ? n_roles
+                     : tokens[0] == "states" ? n_states
+                                             : n_day_phases) = value;
+                }
+                continue;
+            }
+
+            if (tokens.size() != 7) {
+                throw std::invalid_argument{"Expected a transition: " + line};
+            }
+            if (not table) {
+                table.emplace(n_roles, n_states, n_day_phases, role_sizes);
+            }
+            auto [role_begin, role_end] = parse_range(tokens[0], n_roles);
+            auto [state_begin, state_end] = parse_range(tokens[1], n_states);
+            auto [light_begin, light_end] = parse_range(tokens[2], 2);
+            auto [phase_begin, phase_end] = parse_range(tokens[3], n_day_phases);
+            std::optional<int32_t> next_state;
+            if (tokens[4] != "=") {
+                next_state = parse_range(tokens[4], n_states).first;
+            }
+            std::optional<int32_t> next_light;
+            if (tokens[5] != "=") {
+                next_light = parse_range(tokens[5], 2).first;
+            }
+            auto claim = parse_range(tokens[6], 2).first;
+
+            for (auto role = role_begin; role < role_end; ++role) {
+                for (auto state = state_begin; state < state_end; ++state) {
+                    for (auto light = light_begin; light < light_end; ++light) {
+                        for (auto phase = phase_begin; phase < phase_end; ++phase) {
+                            table->At(role, state, light, phase) = {
+                                static_cast<uint16_t>(next_state.value_or(state)),
+                                static_cast<uint8_t>(next_light.value_or(light)),
+                                static_cast<uint8_t>(claim)};
+                        }
+                    }
+                }
+            }
+        }
+
+        if (not table) {
+            table.emplace(n_roles, n_states, n_day_phases, role_sizes);
+        }
+        return std::move(*table);
+    }
+
+    // Writes the header and the transitions that change something in the format of Parse.
+    void Write(std::ostream &output) const {
+        output << "roles " << n_roles << "\nstates " << n_states << "\nphases " << n_day_phases
+               << "\nrole_sizes";
+        for (auto role_size : role_sizes) {
+            output << ' ' << role_size;
+        }
+        output << '\n';
+        for (int32_t role = 0; role < n_roles; ++role) {
+            for (int32_t state = 0; state < n_states; ++state) {
+                for (int32_t light_is_on = 0; light_is_on < 2; ++light_is_on) {
+                    for (int32_t day_phase = 0; day_phase < n_day_phases; ++day_phase) {
+                        const auto &transition = At(role, state, light_is_on, day_phase);
+                        if (transition.next_state != state or
+                            transition.light_is_on != light_is_on or transition.claim) {
+                            output << role << ' ' << state << ' ' << light_is_on << ' '
+                                   << day_phase << ' ' << transition.next_state << ' '
+                                   << static_cast<int32_t>(transition.light_is_on) << ' '
+                                   << static_cast<int32_t>(transition.claim) << '\n';
+                        }
+                    }
+                }
+            }
+        }
+        output << "end\n";
+    }
+
+    static StrategyTable MakeDedicatedCounter(int32_t n_prisoners) {
+        auto table = StrategyTable{2, std::max(2, n_prisoners), 1, {1}};
+        for (int32_t n_counted = 0; n_counted < n_prisoners - 1; ++n_counted) {
+            table.At(0, n_counted, 1, 0) = {static_cast<uint16_t>(n_counted + 1), 0,
+                                            n_counted + 1 == n_prisoners - 1};
+        }
+        table.At(0, n_prisoners - 1, 0, 0).claim = 1;
+        table.At(1, 0, 0, 0) = {1, 1, 0};
+        return table;
+    }
+
+    int32_t n_roles = 0;
+    int32_t n_states = 0;
+    int32_t n_day_phases = 0;
+    std::vector<int32_t> role_sizes;
+    std::vector<Transition> transitions;
+};
+
+// Runs a StrategyTable, which must outlive it, keeping the prisoners' roles and states in
+// flat arrays, so that a day is a single table lookup without branching on the strategy.
+// Prisons with equal seeds see the same visitors, which gives common random numbers when
+// comparing strategies.
+class TablePrison {
+public:
+    TablePrison(const StrategyTable &table, int32_t n_prisoners)
+        : TablePrison{table, n_prisoners, rng::GetGenerator()()} {
+    }
+
+    TablePrison(const StrategyTable &table, int32_t n_prisoners, uint64_t seed)
+        : n_prisoners{n_prisoners},
+          table{&table},
+          roles(n_prisoners),
+          states(n_prisoners),
+          prisoners_have_been_in_the_room_indicators(n_prisoners),
+          excluded_prisoner_id{n_prisoners},
+          generator_(static_cast<std::mt19937::result_type>(seed)),
+          distribution_(0, n_prisoners - 1) {
+        for (int32_t i = 0; i < n_prisoners; ++i) {
+            roles[i] = static_cast<uint8_t>(table.GetRole(i));
+        }
+    }
+
+    [[nodiscard]] bool HaveAllPrisonersBeenInTheRoom() const {
+        return n_prisoners_have_been_in_the_room == n_prisoners;
+    }
+
+    // Adversarial runs: the excluded prisoner never enters the room, so any claim is false.
+    void ExcludePrisoner(int32_t prisoner_id) {
+        excluded_prisoner_id = prisoner_id;
+        distribution_ = std::uniform_int_distribution<int32_t>(0, n_prisoners - 2);
+    }
+
+    PrisonerClaim NextDay() {
+        auto prisoner_id = distribution_(generator_);
+        prisoner_id += prisoner_id >= excluded_prisoner_id;
+        if (not prisoners_have_been_in_the_room_indicators[prisoner_id]) {
+            prisoners_have_been_in_the_room_indicators[prisoner_id] = 1;
+            if (++n_prisoners_have_been_in_the_room == n_prisoners) {
+                all_visited_day_number = day_number + 1;
+            }
+        }
+
+        const auto &transition = table->transitions[table->GetTransitionIndex(
+            roles[prisoner_id], states[prisoner_id], light_is_on,
+            day_number % table->n_day_phases)];
+        states[prisoner_id] = transition.next_state;
+        light_is_on = transition.light_is_on;
+        ++day_number;
+        return static_cast<PrisonerClaim>(transition.claim);
+    }
+
+    int32_t Run() {
+        while (true) {
+            auto prisoner_claim = NextDay();
+            if (prisoner_claim == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+    }
+
+    // Like Run, but gives up after max_n_days days, as tables need not ever claim.
+    std::optional<int32_t> RunForAtMost(int32_t max_n_days) {
+        while (day_number < max_n_days) {
+            auto prisoner_claim = NextDay();
+            if (prisoner_claim == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    int32_t n_prisoners = 0;
+    int32_t day_number = 0;
+    uint8_t light_is_on = 0;
+    const StrategyTable *table = nullptr;
+    std::vector<uint8_t> roles;
+    std::vector<uint16_t> states;
+    std::vector<uint8_t> prisoners_have_been_in_the_room_indicators;
+    int32_t n_prisoners_have_been_in_the_room = 0;
+    // The day on which the last prisoner first entered the room, or 0 before that.
+    int32_t all_visited_day_number = 0;
+    int32_t excluded_prisoner_id = 0;
+
+private:
+    std::mt19937 generator_;
+    std::uniform_int_distribution<int32_t> distribution_;
+};
+
+// Bump allocator for coroutine frames. Frames are only ever freed all together, by Reset or
+// with the pool, so the frames of a prison take a few chunk allocations, reused across runs.
+class FramePool {
+public:
+    static constexpr size_t kChunkSize = size_t{1} << 16;
+    static constexpr size_t kAlignment = alignof(std::max_align_t);
+
+    FramePool() = default;
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    void *Allocate(size_t size) {
+        size = (size + kAlignment - 1) / kAlignment * kAlignment;
+        while (chunk_index < chunks.size() and offset + size > chunks[chunk_index].size) {
+            ++chunk_index;
+            offset = 0;
+        }
+        if (chunk_index == chunks.size()) {
+            auto chunk_size = std::max(kChunkSize, size);
+            chunks.push_back({std::make_unique<std::byte[]>(chunk_size), chunk_size});
+            offset = 0;
+        }
+        auto *memory = chunks[chunk_index].memory.get() + offset;
+        offset += size;
+        return memory;
+    }
+
+    void Reset() {
+        chunk_index = 0;
+        offset = 0;
+    }
+
+    // The pool that coroutine frames created on this thread are allocated from.
+    static FramePool *&GetCurrent() {
+        thread_local FramePool *current = nullptr;
+        return current;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size = 0;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t chunk_index = 0;
+    size_t offset = 0;
+};
+
+struct NextVisit {};
+
+// A prisoner written as a coroutine: "co_await NextVisit{}" suspends until the prisoner's
+// next visit and returns its input, and "co_return claim" makes the claim on the current
+// visit and ends the coroutine, after which the prisoner does nothing.
+class PrisonerTask {
+public:
+    struct promise_type {
+        struct VisitAwaiter {
+            [[nodiscard]] bool await_ready() const noexcept {
+                return promise->has_pending_visit;
+            }
+
+            void await_suspend(std::coroutine_handle<>) const noexcept {
+            }
+
+            PrisonerInput await_resume() const noexcept {
+                promise->has_pending_visit = false;
+                return promise->input;
+            }
+
+            promise_type *promise = nullptr;
+        };
+
+        static constexpr size_t kHeaderSize = FramePool::kAlignment;
+
+        static void *operator new(size_t size) {
+            auto *pool = FramePool::GetCurrent();
+            auto *memory = static_cast<std::byte *>(pool ? pool->Allocate(kHeaderSize + size)
+                                                         : ::operator new(kHeaderSize + size));
+            *reinterpret_cast<FramePool **>(memory) = pool;
+            return memory + kHeaderSize;
+        }
+
+        static void operator delete(void *frame) {
+            auto *memory = static_cast<std::byte *>(frame) - kHeaderSize;
+            if (not *reinterpret_cast<FramePool **>(memory)) {
+                ::operator delete(memory);
+            }
+        }
+
+        PrisonerTask get_return_object() {
+            return PrisonerTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+
+        void return_value(PrisonerClaim prisoner_claim) {
+            claim = prisoner_claim;
+        }
+
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+
+        VisitAwaiter await_transform(NextVisit) {
+            return {this};
+        }
+
+        PrisonerInput input;
+        bool has_pending_visit = false;
+        PrisonerClaim claim = PrisonerClaim::claim_nothing;
+        std::exception_ptr exception;
+    };
+
+    explicit PrisonerTask(std::coroutine_handle<promise_type> handle) : handle{handle} {
+    }
+
+    PrisonerTask(PrisonerTask &&other) noexcept : handle{std::exchange(other.handle, {})} {
+    }
+
+    PrisonerTask &operator=(PrisonerTask &&other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ~PrisonerTask() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    PrisonerClaim Visit(PrisonerInput input) {
+        if (handle.done()) {
+            return PrisonerClaim::claim_nothing;
+        }
+        auto &promise = handle.promise();
+        promise.input = input;
+        promise.has_pending_visit = true;
+        handle.resume();
+        if (promise.exception) {
+            std::rethrow_exception(std::exchange(promise.exception, {}));
+        }
+        return handle.done() ? promise.claim : PrisonerClaim::claim_nothing;
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+using PrisonerCoroutine = PrisonerTask (*)(int32_t prisoner_id, int32_t n_prisoners);
+
+// Runs prisoners written as coroutines, with their frames allocated from frame_pool, which
+// is reset on construction and must outlive the prison.
+class CoroutinePrison {
+public:
+    CoroutinePrison(PrisonerCoroutine prisoner_coroutine, int32_t n_prisoners,
+                    FramePool &frame_pool)
+        : n_prisoners{n_prisoners},
+          prisoners_have_been_in_the_room_indicators(n_prisoners),
+          distribution_(0, n_prisoners - 1) {
+        frame_pool.Reset();
+        auto *previous_frame_pool = std::exchange(FramePool::GetCurrent(), &frame_pool);
+        prisoners.reserve(n_prisoners);
+        for (int32_t i = 0; i < n_prisoners; ++i) {
+            prisoners.push_back(prisoner_coroutine(i, n_prisoners));
+        }
+        FramePool::GetCurrent() = previous_frame_pool;
+    }
+
+    [[nodiscard]] bool HaveAllPrisonersBeenInTheRoom() const {
+        return n_prisoners_have_been_in_the_room == n_prisoners;
+    }
+
+    void LetIntoTheRoom(int32_t prisoner_id) {
+        if (not prisoners_have_been_in_the_room_indicators[prisoner_id]) {
+            prisoners_have_been_in_the_room_indicators[prisoner_id] = 1;
+            if (++n_prisoners_have_been_in_the_room == n_prisoners) {
+                all_visited_day_number = day_number + 1;
+            }
+        }
+    }
+
+    PrisonerClaim NextDay() {
+        auto prisoner_id = distribution_(rng::GetGenerator());
+        LetIntoTheRoom(prisoner_id);
+        auto prisoner_claim = prisoners[prisoner_id].Visit({day_number, &light});
+        ++day_number;
+        return prisoner_claim;
+    }
+
+    int32_t Run() {
+        while (true) {
+            auto prisoner_claim = NextDay();
+            if (prisoner_claim == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+    }
+
+    int32_t n_prisoners = 0;
+    int32_t day_number = 0;
+    Light light = Light{};
+    std::vector<PrisonerTask> prisoners;
+    std::vector<uint8_t> prisoners_have_been_in_the_room_indicators;
+    int32_t n_prisoners_have_been_in_the_room = 0;
+    // The day on which the last prisoner first entered the room, or 0 before that.
+    int32_t all_visited_day_number = 0;
+
+private:
+    std::uniform_int_distribution<int32_t> distribution_;
+};
+
+PrisonerTask DedicatedCounterPrisonerCoroutine(int32_t prisoner_id, int32_t n_prisoners) {
+    auto visit = co_await NextVisit{};
+    if (prisoner_id == 0) {
+        int32_t times_turned_off_the_light = 0;
+        while (true) {
+            if (visit.light->IsOn()) {
+                visit.light->TurnOff();
+                ++times_turned_off_the_light;
+            }
+            if (times_turned_off_the_light == n_prisoners - 1) {
+                co_return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+            }
+            visit = co_await NextVisit{};
+        }
+    }
+
+    while (visit.light->IsOn()) {
+        visit = co_await NextVisit{};
+    }
+    visit.light->TurnOn();
+    co_return PrisonerClaim::claim_nothing;
+}
+
+// DynamicCounterPrisoner with the default snowball stage length, its stages being the
+// coroutine's control flow rather than state checked on every visit.
+PrisonerTask DynamicCounterPrisonerCoroutine(int32_t, int32_t n_prisoners) {
+    auto snowball_stage_length =
+        DynamicCounterPrisoner::ComputeDefaultSnowballStageLength(n_prisoners);
+    auto visit = co_await NextVisit{};
+
+    if (visit.day_number < snowball_stage_length and
+        (visit.day_number == 0 or visit.light->IsOn())) {
+        if (visit.day_number + 1 == n_prisoners) {
+            co_return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+        }
+        visit.light->TurnOn();
+        int32_t n_counted_prisoners = 0;
+        if (visit.day_number == snowball_stage_length - 1) {
+            n_counted_prisoners = snowball_stage_length;
+        } else {
+            visit = co_await NextVisit{};
+            if (visit.day_number < snowball_stage_length and visit.light->IsOn()) {
+                n_counted_prisoners = visit.day_number;
+            }
+        }
+        if (n_counted_prisoners == 0) {
+            co_return PrisonerClaim::claim_nothing;
+        }
+
+        visit.light->TurnOff();
+        while (n_counted_prisoners < n_prisoners) {
+            visit = co_await NextVisit{};
+            if (visit.light->IsOn()) {
+                visit.light->TurnOff();
+                ++n_counted_prisoners;
+            }
+        }
+        co_return PrisonerClaim::claim_that_everyone_has_been_in_the_room;
+    }
+
+    while (visit.day_number < snowball_stage_length or visit.light->IsOn()) {
+        visit = co_await NextVisit{};
+    }
+    visit.light->TurnOn();
+    co_return PrisonerClaim::claim_nothing;
+}
+
+namespace plugins {
+struct LoadedStrategy {
+    const PrisonersPluginStrategy *strategy = nullptr;
+    // Identifies the strategy in the results store by the plugin's path and content, so that a
+    // rebuilt plugin doesn't reuse the days of its previous build.
+    std::string key;
+};
+
+// Strategies of the loaded plugins by name. Plugins stay loaded until exit.
+std::map<std::string, LoadedStrategy> &GetStrategies() {
+    static std::map<std::string, LoadedStrategy> strategies;
+    return strategies;
+}
+
+// 64-bit FNV-1a of the file's bytes, in hexadecimal.
+std::string HashFile(const std::string &path) {
+    std::ifstream file{path, std::ios::binary};
+    if (not file) {
+        throw std::runtime_error{"Cannot read plugin " + path + "."};
+    }
+    uint64_t hash = 14695981039346656037ull;
+    for (char c; file.get(c);) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    std::ostringstream oss;
+    oss << std::hex << hash;
+    return oss.str();
+}
+
+void Load(const std::string &path) {
+#ifdef __linux__
+    auto key_suffix =
+        " from " + std::filesystem::weakly_canonical(path).string() + " " + HashFile(path);
+    auto *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (not handle) {
+        throw std::runtime_error{"Cannot load plugin " + path + ": " + dlerror()};
+    }
+    auto get_strategies = reinterpret_cast<PrisonersPluginGetStrategies>(
+        dlsym(handle, PRISONERS_PLUGIN_GET_STRATEGIES_SYMBOL));
+    if (not get_strategies) {
+        throw std::runtime_error{"Plugin " + path + " exports no strategies."};
+    }
+    int32_t n_strategies = 0;
+    const auto *strategies = get_strategies(PRISONERS_PLUGIN_ABI_VERSION, &n_strategies);
+    if (not strategies) {
+        throw std::runtime_error{"Plugin " + path + " doesn't support this ABI version."};
+    }
+    for (int32_t i = 0; i < n_strategies; ++i) {
+        GetStrategies()[strategies[i].name] = {&strategies[i],
+                                               "plugin " + std::string{strategies[i].name} +
+                                                   key_suffix};
+    }
+#else
+    throw std::runtime_error{"Cannot load plugin " + path + " on this platform."};
+#endif
+}
+}  // namespace plugins
+
+// Runs a plugin strategy, kBatchNDays days per call into the plugin. The visitors are drawn
+// from rng::GetGenerator as in Prison, so a plugin port of a strategy sees the same days.
+class PluginPrison {
+public:
+    static constexpr int64_t kBatchNDays = 4096;
+
+    PluginPrison(const PrisonersPluginStrategy &strategy, int32_t n_prisoners)
+        : n_prisoners{n_prisoners},
+          strategy{&strategy},
+          simulation{strategy.create_simulation(n_prisoners)},
+          visitors(kBatchNDays),
+          prisoners_have_been_in_the_room_indicators(n_prisoners),
+          distribution_(0, n_prisoners - 1) {
+    }
+
+    PluginPrison(const PluginPrison &) = delete;
+    PluginPrison &operator=(const PluginPrison &) = delete;
+
+    ~PluginPrison() {
+        strategy->destroy_simulation(simulation);
+    }
+
+    [[nodiscard]] bool HaveAllPrisonersBeenInTheRoom() const {
+        return n_prisoners_have_been_in_the_room == n_prisoners;
+    }
+
+    int32_t Run() {
+        while (true) {
+            for (auto &visitor : visitors) {
+                visitor = distribution_(rng::GetGenerator());
+            }
+            auto claim_index = strategy->run_days(simulation, visitors.data(), kBatchNDays);
+            if (claim_index < 0 or claim_index > kBatchNDays) {
+                throw std::runtime_error{"Plugin strategy " + std::string{strategy->name} +
+                                         " returned a day out of its batch."};
+            }
+            auto n_days = std::min(claim_index + 1, kBatchNDays);
+            for (int64_t i = 0; i < n_days; ++i) {
+                if (not prisoners_have_been_in_the_room_indicators[visitors[i]]) {
+                    prisoners_have_been_in_the_room_indicators[visitors[i]] = 1;
+                    if (++n_prisoners_have_been_in_the_room == n_prisoners) {
+                        all_visited_day_number = day_number + static_cast<int32_t>(i) + 1;
+                    }
+                }
+            }
+            day_number += static_cast<int32_t>(n_days);
+            if (claim_index < kBatchNDays) {
+                if (HaveAllPrisonersBeenInTheRoom()) {
+                    return day_number;
+                } else {
+                    throw FalsePrisonerClaimException{};
+                }
+            }
+        }
+    }
+
+    int32_t n_prisoners = 0;
+    int32_t day_number = 0;
+    const PrisonersPluginStrategy *strategy = nullptr;
+    void *simulation = nullptr;
+    std::vector<int32_t> visitors;
+    std::vector<uint8_t> prisoners_have_been_in_the_room_indicators;
+    int32_t n_prisoners_have_been_in_the_room = 0;
+    // The day on which the last prisoner first entered the room, or 0 before that.
+    int32_t all_visited_day_number = 0;
+
+private:
+    std::uniform_int_distribution<int32_t> distribution_;
+};
+
+struct StrategyTableSearchConfig {
+    int32_t n_prisoners = 8;
+    int32_t n_roles = 2;
+    int32_t n_states = 16;
+    int32_t n_day_phases = 2;
+    std::vector<int32_t> role_sizes = {1};
+    int32_t population_size = 64;
+    int32_t n_elites = 8;
+    int32_t tournament_size = 4;
+    int32_t max_n_mutations = 4;
+    // Adversarial runs with one prisoner never entering the room, for up to
+    // max_n_excluded_prisoners different prisoners.
+    int32_t max_n_excluded_prisoners = 16;
+    int32_t n_adversarial_runs_per_excluded_prisoner = 4;
+    int32_t n_evaluation_simulations = 256;
+    // Runs are censored after max_n_days_per_squared_prisoner * n^2 days, counting as that many.
+    int32_t max_n_days_per_squared_prisoner = 64;
+    uint64_t seed = 0;
+    int32_t n_threads = parallel::GetNThreads();
+};
+
+// Genetic search over strategy tables of fixed dimensions. Unsafe candidates are rejected by
+// adversarial runs, and the others are scored by mean days over the same seeds for every
+// candidate, so that scores are compared with common random numbers.
+class StrategyTableSearch {
+public:
+    struct Candidate {
+        StrategyTable table;
+        bool is_safe = false;
+        double days_mean = std::numeric_limits<double>::infinity();
+    };
+
+    explicit StrategyTableSearch(StrategyTableSearchConfig config)
+        : config{std::move(config)},
+          generator_(this->config.seed ? this->config.seed : rng::GetDevice()()),
+          evaluation_seed_(generator_()) {
+        // Adversarial runs need a prisoner left to visit the room.
+        if (this->config.n_prisoners < 2) {
+            throw std::invalid_argument{"The search needs at least two prisoners."};
+        }
+    }
+
+    [[nodiscard]] int32_t GetMaxNDays() const {
+        return static_cast<int32_t>(std::min<int64_t>(
+            int64_t{config.max_n_days_per_squared_prisoner} * config.n_prisoners *
+                config.n_prisoners,
+            std::numeric_limits<int32_t>::max()));
+    }
+
+    // Seeds of the evaluation runs, mixed from the kind of run and its indices, so that the
+    // seeds of different runs don't collide in the 32 bits TablePrison keeps of them.
+    [[nodiscard]] uint64_t GetEvaluationSeed(uint32_t run_kind, uint32_t i, uint32_t run) const {
+        std::seed_seq seed_seq{static_cast<uint32_t>(evaluation_seed_),
+                               static_cast<uint32_t>(evaluation_seed_ >> 32), run_kind, i, run};
+        std::array<uint32_t, 1> seed{};
+        seed_seq.generate(seed.begin(), seed.end());
+        return seed[0];
+    }
+
+    StrategyTable MakeEmptyTable() const {
+        return {config.n_roles, config.n_states, config.n_day_phases, config.role_sizes};
+    }
+
+    // The dedicated counter, when it fits the dimensions, seeds the population with a safe
+    // candidate, while the rest is random.
+    void InitializePopulation() {
+        population.clear();
+        auto dedicated_counter = StrategyTable::MakeDedicatedCounter(config.n_prisoners);
+        if (config.n_roles == dedicated_counter.n_roles and
+            config.role_sizes == dedicated_counter.role_sizes and
+            config.n_states >= dedicated_counter.n_states) {
+            auto table = MakeEmptyTable();
+            for (int32_t role = 0; role < table.n_roles; ++role) {
+                for (int32_t state = 0; state < dedicated_counter.n_states; ++state) {
+                    for (int32_t light_is_on = 0; light_is_on < 2; ++light_is_on) {
+                        for (int32_t day_phase = 0; day_phase < table.n_day_phases; ++day_phase) {
+                            table.At(role, state, light_is_on, day_phase) =
+                                dedicated_counter.At(role, state, light_is_on, 0);
+                        }
+                    }
+                }
+            }
+            population.push_back({std::move(table)});
+        }
+        while (static_cast<int32_t>(population.size()) < config.population_size) {
+            auto table = MakeEmptyTable();
+            for (size_t i = 0; i < table.transitions.size(); ++i) {
+                Mutate(table);
+            }
+            population.push_back({std::move(table)});
+        }
+        generation = 0;
+        EvaluatePopulation();
+    }
+
+    void Mutate(StrategyTable &table) {
+        auto &transition = table.transitions[std::uniform_int_distribution<size_t>(
+            0, table.transitions.size() - 1)(generator_)];
+        switch (std::uniform_int_distribution<int32_t>(0, 3)(generator_)) {
+            case 0:
+            case 1:
+                transition.next_state = static_cast<uint16_t>(
+                    std::uniform_int_distribution<int32_t>(0, table.n_states - 1)(generator_));
+                break;
+            case 2:
+                transition.light_is_on ^= 1;
+                break;
+            default:
+                transition.claim ^= 1;
+        }
+    }
+
+    StrategyTable Crossover(const StrategyTable &first, const StrategyTable &second) {
+        auto child = first;
+        auto block_size = static_cast<size_t>(2 * child.n_day_phases);
+        for (size_t block = 0; block < child.transitions.size(); block += block_size) {
+            if (generator_() & 1) {
+                std::copy_n(second.transitions.begin() + block, block_size,
+                            child.transitions.begin() + block);
+            }
+        }
+        return child;
+    }
+
+    const Candidate &SelectByTournament() {
+        const Candidate *winner = nullptr;
+        for (int32_t i = 0; i < config.tournament_size; ++i) {
+            const auto &candidate = population[std::uniform_int_distribution<size_t>(
+                0, population.size() - 1)(generator_)];
+            if (not winner or candidate.days_mean < winner->days_mean) {
+                winner = &candidate;
+            }
+        }
+        return *winner;
+    }
+
+    void Evaluate(Candidate &candidate) const {
+        candidate.is_safe = false;
+        candidate.days_mean = std::numeric_limits<double>::infinity();
+        auto max_n_days = GetMaxNDays();
+        try {
+            auto n_excluded_prisoners =
+                std::min(config.n_prisoners, config.max_n_excluded_prisoners);
+            for (int32_t i = 0; i < n_excluded_prisoners; ++i) {
+                auto excluded_prisoner_id =
+                    static_cast<int32_t>(static_cast<int64_t>(i) * config.n_prisoners /
+                                         n_excluded_prisoners);
+                for (int32_t run = 0; run < config.n_adversarial_runs_per_excluded_prisoner;
+                     ++run) {
+                    auto prison = TablePrison{candidate.table, config.n_prisoners,
+                                              GetEvaluationSeed(0, i, run)};
+                    prison.ExcludePrisoner(excluded_prisoner_id);
+                    if (prison.RunForAtMost(max_n_days)) {
+                        return;
+                    }
+                }
+            }
+
+            double days_sum = 0;
+            for (int32_t i = 0; i < config.n_evaluation_simulations; ++i) {
+                auto prison = TablePrison{candidate.table, config.n_prisoners,
+                                          GetEvaluationSeed(1, i, 0)};
+                days_sum += prison.RunForAtMost(max_n_days).value_or(max_n_days);
+            }
+            candidate.is_safe = true;
+            candidate.days_mean = days_sum / config.n_evaluation_simulations;
+        } catch (const FalsePrisonerClaimException &) {
+        }
+    }
+
+    void EvaluatePopulation() {
+        parallel::ForEachIndex(static_cast<int32_t>(population.size()), config.n_threads,
+                               [this](int32_t i) { Evaluate(population[i]); });
+        std::stable_sort(population.begin(), population.end(),
+                         [](const Candidate &first, const Candidate &second) {
+                             return first.days_mean < second.days_mean;
+                         });
+    }
+
+    void NextGeneration() {
+        std::vector<Candidate> next_population(
+            population.begin(),
+            population.begin() + std::min<size_t>(config.n_elites, population.size()));
+        while (static_cast<int32_t>(next_population.size()) < config.population_size) {
+            auto table = Crossover(SelectByTournament().table, SelectByTournament().table);
+            auto n_mutations =
+                std::uniform_int_distribution<int32_t>(1, config.max_n_mutations)(generator_);
+            for (int32_t i = 0; i < n_mutations; ++i) {
+                Mutate(table);
+            }
+            next_population.push_back({std::move(table)});
+        }
+        population = std::move(next_population);
+        ++generation;
+        EvaluatePopulation();
+    }
+
+    [[nodiscard]] const Candidate &GetBest() const {
+        return population.front();
+    }
+
+    [[nodiscard]] int32_t GetNSafeCandidates() const {
+        return static_cast<int32_t>(std::count_if(population.begin(), population.end(),
+                                                  [](const auto &x) { return x.is_safe; }));
+    }
+
+    // The checkpoint is the generation number followed by the population's tables.
+    void SaveCheckpoint(const std::string &path) const {
+        auto temporary_path = path + ".tmp";
+        {
+            std::ofstream file{temporary_path};
+            file << "generation " << generation << '\n';
+            for (const auto &candidate : population) {
+                candidate.table.Write(file);
+            }
+            if (not file) {
+                throw std::runtime_error{"Cannot write checkpoint."};
+            }
+        }
+        std::filesystem::rename(temporary_path, path);
+    }
+
+    bool LoadCheckpoint(const std::string &path) {
+        std::ifstream file{path};
+        std::string keyword;
+        if (not(file >> keyword >> generation) or keyword != "generation") {
+            return false;
+        }
+        population.clear();
+        while (file >> std::ws and file.peek() != std::ifstream::traits_type::eof()) {
+            auto table = StrategyTable::Parse(file);
+            if (table.transitions.size() != MakeEmptyTable().transitions.size()) {
+                throw std::invalid_argument{"Checkpoint does not match the search dimensions."};
+            }
+            population.push_back({std::move(table)});
+        }
+        EvaluatePopulation();
+        return true;
+    }
+
+    StrategyTableSearchConfig config;
+    int32_t generation = 0;
+    std::vector<Candidate> population;
+
+private:
+    std::mt19937_64 generator_;
+    uint64_t evaluation_seed_ = 0;
+};
+
+namespace stats {
+// Quantile of sorted samples, linearly interpolated between closest ranks.
+double Quantile(const std::vector<double> &sorted_samples, double quantile) {
+    assert(not sorted_samples.empty());
+    auto position = quantile * static_cast<double>(sorted_samples.size() - 1);
+    auto index = static_cast<size_t>(position);
+    if (index + 1 >= sorted_samples.size()) {
+        return sorted_samples.back();
+    }
+    auto fraction = position - static_cast<double>(index);
+    return sorted_samples[index] + fraction * (sorted_samples[index + 1] - sorted_samples[index]);
+}
+
+struct ConfidenceInterval {
+    double lower = 0;
+    double upper = 0;
+};
+
+// Percentile bootstrap intervals of the quantiles of samples. Resample i is drawn with seed
+// seed + i, so the intervals don't depend on how the resamples are spread across threads.
+std::vector<ConfidenceInterval> BootstrapQuantileIntervals(const std::vector<double> &samples,
+                                                           const std::vector<double> &quantiles,
+                                                           double confidence,
+                                                           int32_t n_resamples,
+                                                           int32_t n_threads, uint64_t seed) {
+    assert(not samples.empty() and n_resamples > 0);
+    std::vector<std::vector<double>> resampled_quantiles(
+        quantiles.size(), std::vector<double>(n_resamples));
+    parallel::ForEachIndex(n_resamples, n_threads, [&](int32_t resample_index) {
+        std::mt19937_64 generator{seed + static_cast<uint64_t>(resample_index)};
+        std::uniform_int_distribution<size_t> distribution{0, samples.size() - 1};
+        std::vector<double> resample(samples.size());
+        for (auto &sample : resample) {
+            sample = samples[distribution(generator)];
+        }
+        std::sort(resample.begin(), resample.end());
+        for (size_t i = 0; i < quantiles.size(); ++i) {
+            resampled_quantiles[i][resample_index] = Quantile(resample, quantiles[i]);
+        }
+    });
+
+    std::vector<ConfidenceInterval> intervals;
+    for (auto &values : resampled_quantiles) {
+        std::sort(values.begin(), values.end());
+        intervals.push_back(
+            {Quantile(values, (1 - confidence) / 2), Quantile(values, (1 + confidence) / 2)});
+    }
+    return intervals;
+}
+
+// Expected number of uniform draws until each of n coupons has been drawn, n * H_n.
+double CouponCollectorMean(int32_t n) {
+    double harmonic_number = 0;
+    for (int32_t i = 1; i <= n; ++i) {
+        harmonic_number += 1.0 / i;
+    }
+    return n * harmonic_number;
+}
+
+struct ControlVariateEstimate {
+    double mean = 0;
+    double std = 0;
+    // Fraction of the variance of the plain mean that the control removes, the squared
+    // correlation of the samples and the controls.
+    double variance_reduction = 0;
+};
+
+// Estimates the mean of samples, corrected by how far the mean of the paired controls is from
+// their known mean control_mean, with the variance minimizing coefficient.
+ControlVariateEstimate ControlVariateMean(const std::vector<double> &samples,
+                                          const std::vector<double> &controls,
+                                          double control_mean) {
+    assert(not samples.empty() and samples.size() == controls.size());
+    auto n = static_cast<double>(samples.size());
+    auto samples_mean = std::reduce(samples.begin(), samples.end()) / n;
+    auto controls_mean = std::reduce(controls.begin(), controls.end()) / n;
+    double covariance = 0;
+    double samples_variance = 0;
+    double controls_variance = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        covariance += (samples[i] - samples_mean) * (controls[i] - controls_mean);
+        samples_variance += (samples[i] - samples_mean) * (samples[i] - samples_mean);
+        controls_variance += (controls[i] - controls_mean) * (controls[i] - controls_mean);
+    }
+    if (controls_variance == 0 or samples_variance == 0) {
+        return {samples_mean, std::sqrt(samples_variance / n / n), 0};
+    }
+    auto coefficient = covariance / controls_variance;
+    auto variance_reduction = covariance * covariance / (samples_variance * controls_variance);
+    return {samples_mean - coefficient * (controls_mean - control_mean),
+            std::sqrt(samples_variance * (1 - variance_reduction) / n / n), variance_reduction};
+}
+
+struct TestResult {
+    double statistic = 0;
+    double p_value = 1;
+};
+
+double TwoSidedNormalPValue(double z) {
+    return std::erfc(std::abs(z) / std::sqrt(2.0));
+}
+
+// Ranks starting from 1, ties get their average rank. Returns sum(t^3 - t) over tie groups.
+double ComputeRanks(const std::vector<double> &values, std::vector<double> &ranks) {
+    std::vector<size_t> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t lhs, size_t rhs) { return values[lhs] < values[rhs]; });
+    ranks.resize(values.size());
+    double tie_correction = 0;
+    for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+        while (end < order.size() and values[order[end]] == values[order[begin]]) {
+            ++end;
+        }
+        auto average_rank = static_cast<double>(begin + end + 1) / 2;
+        for (auto i = begin; i < end; ++i) {
+            ranks[order[i]] = average_rank;
+        }
+        auto n_ties = static_cast<double>(end - begin);
+        tie_correction += n_ties * n_ties * n_ties - n_ties;
+    }
+    return tie_correction;
+}
+
+// The statistic is U / (|a| |b|), the probability that a sample of a exceeds a sample of b,
+// counting ties as half. The p-value is the two-sided normal approximation.
+TestResult MannWhitneyUTest(const std::vector<double> &a, const std::vector<double> &b) {
+    auto n_a = static_cast<double>(a.size());
+    auto n_b = static_cast<double>(b.size());
+    auto n = n_a + n_b;
+    std::vector<double> values{a};
+    values.insert(values.end(), b.begin(), b.end());
+    std::vector<double> ranks;
+    auto tie_correction = ComputeRanks(values, ranks);
+
+    auto u = std::accumulate(ranks.begin(), ranks.begin() + a.size(), 0.0) - n_a * (n_a + 1) / 2;
+    auto variance = n_a * n_b / 12 * (n + 1 - tie_correction / (n * (n - 1)));
+    auto p_value = variance > 0 ? TwoSidedNormalPValue((u - n_a * n_b / 2) / std::sqrt(variance))
+                                : 1.0;
+    return {u / (n_a * n_b), p_value};
+}
+
+// The statistic is the largest distance between the empirical distribution functions, the
+// p-value is from its asymptotic distribution.
+TestResult KolmogorovSmirnovTest(std::vector<double> a, std::vector<double> b) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    auto n_a = static_cast<double>(a.size());
+    auto n_b = static_cast<double>(b.size());
+    double distance = 0;
+    for (size_t i = 0, j = 0; i < a.size() and j < b.size();) {
+        auto value = std::min(a[i], b[j]);
+        while (i < a.size() and a[i] == value) {
+            ++i;
+        }
+        while (j < b.size() and b[j] == value) {
+            ++j;
+        }
+        distance = std::max(distance, std::abs(i / n_a - j / n_b));
+    }
+
+    auto effective_n = std::sqrt(n_a * n_b / (n_a + n_b));
+    auto lambda = (effective_n + 0.12 + 0.11 / effective_n) * distance;
+    double p_value = 0;
+    for (int32_t k = 1; k <= 100; ++k) {
+        p_value += (k % 2 ? 2 : -2) * std::exp(-2.0 * k * k * lambda * lambda);
+    }
+    return {distance, lambda < 0.3 ? 1.0 : std::clamp(p_value, 0.0, 1.0)};
+}
+
+// Wilcoxon signed-rank test of paired samples, for runs of two strategies on common random
+// numbers. The statistic is the mean of the differences a - b.
+TestResult WilcoxonSignedRankTest(const std::vector<double> &a, const std::vector<double> &b) {
+    assert(a.size() == b.size());
+    std::vector<double> differences;
+    std::vector<double> absolute_differences;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] != b[i]) {
+            differences.push_back(a[i] - b[i]);
+            absolute_differences.push_back(std::abs(a[i] - b[i]));
+        }
+    }
+    auto mean_difference =
+        std::reduce(a.begin(), a.end()) / a.size() - std::reduce(b.begin(), b.end()) / b.size();
+    if (differences.empty()) {
+        return {mean_difference, 1};
+    }
+
+    std::vector<double> ranks;
+    auto tie_correction = ComputeRanks(absolute_differences, ranks);
+    double positive_rank_sum = 0;
+    for (size_t i = 0; i < differences.size(); ++i) {
+        positive_rank_sum += differences[i] > 0 ? ranks[i] : 0;
+    }
+    auto n = static_cast<double>(differences.size());
+    auto variance = n * (n + 1) * (2 * n + 1) / 24 - tie_correction / 48;
+    auto z = (positive_rank_sum - n * (n + 1) / 4) / std::sqrt(variance);
+    return {mean_difference, TwoSidedNormalPValue(z)};
+}
+}  // namespace stats
+
+namespace test {
+
+int64_t Factorial(int32_t n) {
+    int64_t result = 1;
+    for (int32_t i = 1; i <= n; ++i) {
+        result *= i;
+    }
+    return result;
+}
+
+template <class T>
+bool IsClose(T first, T second, T eps = 1.0e-7) {
+    return std::abs(first - second) < eps;
+}
+
+void TestStrategyTables() {
+    for (int32_t n_prisoners : {1, 2, 3, 50}) {
+        auto table = StrategyTable::MakeDedicatedCounter(n_prisoners);
+        TablePrison(table, n_prisoners).Run();
+    }
+
+    std::istringstream iss{R"(
+        # Dedicated counter for 3 prisoners.
+        roles 2
+        states 3
+        phases 1
+        role_sizes 1
+        0 0 1 * 1 0 0
+        0 1 1 * 2 0 1
+        0 2 0 * = = 1
+        1 0 0 * 1 1 0
+    )"};
+    auto table = StrategyTable::Parse(iss);
+    assert(table.transitions == StrategyTable::MakeDedicatedCounter(3).transitions);
+    assert(table.GetRole(0) == 0 and table.GetRole(1) == 1 and table.GetRole(2) == 1);
+
+    std::stringstream written;
+    table.Write(written);
+    assert(StrategyTable::Parse(written).transitions == table.transitions);
+
+    auto config = StrategyTableSearchConfig{};
+    config.n_prisoners = 4;
+    config.n_states = 6;
+    config.population_size = 8;
+    config.n_elites = 2;
+    config.n_evaluation_simulations = 16;
+    config.seed = 1;
+    auto search = StrategyTableSearch{config};
+    search.InitializePopulation();
+    assert(search.GetBest().is_safe);
+    search.NextGeneration();
+    assert(search.GetBest().is_safe);
+}
+
+void TestStatistics() {
+    std::vector<double> samples{4, 1, 3, 2, 5};
+    std::vector<double> sorted_samples{1, 2, 3, 4, 5};
+    assert(IsClose(stats::Quantile(sorted_samples, 0.5), 3.0));
+    assert(IsClose(stats::Quantile(sorted_samples, 0.9), 4.6));
+
+    auto intervals = stats::BootstrapQuantileIntervals(samples, {0.5}, 0.95, 200, 2, 0);
+    assert(intervals.front().lower >= 1 and intervals.front().upper <= 5);
+
+    std::vector<double> shifted_samples{11, 12, 13, 14, 15};
+    assert(IsClose(stats::MannWhitneyUTest(samples, samples).statistic, 0.5));
+    assert(IsClose(stats::MannWhitneyUTest(samples, shifted_samples).statistic, 0.0));
+    assert(IsClose(stats::KolmogorovSmirnovTest(samples, shifted_samples).statistic, 1.0));
+    assert(IsClose(stats::KolmogorovSmirnovTest(samples, samples).p_value, 1.0));
+    assert(IsClose(stats::WilcoxonSignedRankTest(samples, samples).p_value, 1.0));
+    assert(IsClose(stats::WilcoxonSignedRankTest(shifted_samples, samples).statistic, 10.0));
+
+    assert(IsClose(stats::CouponCollectorMean(2), 3.0));
+    std::vector<double> controls{3, 0, 2, 1, 4};
+    auto estimate = stats::ControlVariateMean(samples, controls, 1.0);
+    assert(IsClose(estimate.mean, 2.0) and IsClose(estimate.variance_reduction, 1.0));
+}
+
+template <class Prisoner>
+void Test() {
+
+    TestStrategyTables();
+    TestStatistics();
+
+    for (int32_t n = 1; n <= 10; ++n) {
+        for (int32_t k = 1; k <= n; ++k) {
+            auto expected_n_choose_k = Factorial(n) / Factorial(k) / Factorial(n - k);
+            auto n_choose_k = StageSchedule::NChooseK(n, k);
+            assert(n_choose_k == expected_n_choose_k);
+        }
+    }
+
+    auto n_choose_k = StageSchedule::NChooseK<double>(64, 32);
+    assert(IsClose(n_choose_k, 1832624140942590534.0, 1.0e+3));
+
+    {
+        auto n_prisoners = 5;
+        auto k_prisoners = 2;
+        auto n_days = 2;
+        double expected_probability = 0.08;
+        double probability =
+            StageSchedule::ComputeProbabilityThatKFixedPrisonersWereInTheRoomDuringNDays(
+                k_prisoners, n_days, n_prisoners);
+        assert(IsClose(probability, expected_probability));
+
+        n_prisoners = 4;
+        k_prisoners = 2;
+        n_days = 3;
+        expected_probability = 9.0 / 32;
+        probability = StageSchedule::ComputeProbabilityThatKFixedPrisonersWereInTheRoomDuringNDays(
+            k_prisoners, n_days, n_prisoners);
+        assert(IsClose(probability, expected_probability));
+    }
+
+    {
+        std::vector<std::pair<int32_t, int32_t>> k_and_n_prisoners;
+        for (int32_t n_prisoners = 1; n_prisoners <= 300; n_prisoners += 7) {
+            for (auto k_prisoners : TokenPrisoner::GetNPrisonersToVisitAtStages(n_prisoners)) {
+                k_and_n_prisoners.emplace_back(k_prisoners, n_prisoners);
+            }
+        }
+        auto days =
+            StageSchedule::ComputeNumbersOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+                k_and_n_prisoners, 0.95, 2);
+        for (size_t i = 0; i < days.size(); ++i) {
+            auto [k_prisoners, n_prisoners] = k_and_n_prisoners[i];
+            assert(days[i] ==
+                   StageSchedule::SearchNumberOfDays(k_prisoners, 0.95, n_prisoners, 1));
+            // Later single solutions are the batch's.
+            assert(
+                days[i] ==
+                StageSchedule::ComputeNumberOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+                    k_prisoners, 0.95, n_prisoners));
+        }
+    }
+
+    for (int32_t n_prisoners = 1; n_prisoners <= 100; n_prisoners *= 2) {
+        Prison<Prisoner>(n_prisoners).Run();
+    }
+    Prison<Prisoner>(100).Run();
+
+    for (int32_t snowball_stage_length : {1, 2, 10, 1000}) {
+        for (int32_t n_prisoners : {1, 2, 50}) {
+            Prison<DynamicCounterPrisoner>(n_prisoners, snowball_stage_length).Run();
+        }
+        // A lone prisoner is the whole snowball on day 0.
+        assert(Prison<DynamicCounterPrisoner>(1, snowball_stage_length).Run() == 1);
+    }
+
+    {
+        auto schedule = StageSchedule{{{2, 0, 3}, {1, 2, 0}}, false};
+        std::vector<int32_t> expected_stage_indices = {0, 0, 2, 2, 2, 0, 1, 1, 3, 3};
+        for (int32_t day = 0; day < static_cast<int32_t>(expected_stage_indices.size()); ++day) {
+            assert(schedule.GetStageIndex(day) == expected_stage_indices[day]);
+        }
+        assert(not schedule.IsOver(7) and schedule.IsOver(8));
+
+        schedule = StageSchedule{{{2, 0, 3}, {1, 2, 0}}};
+        assert(schedule.GetStageIndex(8) == 0 and schedule.GetStageIndex(10) == 1);
+
+        // Cycles whose shortest stages differ a lot, an empty one among them, against a scan
+        // of the days.
+        std::vector<std::vector<int32_t>> cycle_stage_lengths = {
+            {1, 7, 2}, {40, 90, 33}, {0, 0, 0}, {1000, 3000, 1500}, {2, 1, 1}};
+        schedule = StageSchedule{cycle_stage_lengths, false};
+        int32_t day = 0;
+        for (const auto &stage_lengths : cycle_stage_lengths) {
+            for (int32_t i = 0; i < 3; ++i) {
+                for (int32_t j = 0; j < stage_lengths[i]; ++j, ++day) {
+                    assert(schedule.GetStageIndex(day) == i);
+                }
+            }
+        }
+        assert(schedule.IsOver(day) and not schedule.IsOver(day - 1));
+    }
+
+    std::vector<StageScheduleShape> schedule_shapes(5);
+    schedule_shapes[0].max_n_cycles = 1;
+    schedule_shapes[1].max_n_cycles = 3;
+    schedule_shapes[1].per_cycle_stage_length_ratio = 0.5;
+    schedule_shapes[2].per_cycle_stage_length_ratio = 1.5;
+    schedule_shapes[3].explicit_cycle_stage_lengths = {{50, 20, 10, 5, 5, 5}, {10, 5, 5, 1, 1, 1}};
+    schedule_shapes[4].stage_probabilities = {0.99, 0.9, 0.8, 0.7, 0.6, 0.5};
+    for (const auto &schedule_shape : schedule_shapes) {
+        if (schedule_shape.max_n_cycles > 0) {
+            Prison<TokenThenCounterPrisoner>(50, schedule_shape).Run();
+        } else {
+            Prison<TokenPrisoner>(50, schedule_shape).Run();
+        }
+    }
+    for (int32_t i = 0; i < 3; ++i) {
+        Prison<RegisterTokenPrisoner<4>>(50, schedule_shapes[i]).Run();
+    }
+
+    for (int32_t n_prisoners : {1, 2, 3, 10, 50}) {
+        for (int32_t n_cycles : {1, 2}) {
+            // Until its cycles are over, token cycles then a counter is TokenPrisoner, so on the
+            // same visitors it takes the same days if it finishes within them.
+            auto generator = rng::GetGenerator();
+            auto days = Prison<TokenThenCounterPrisoner>(n_prisoners, n_cycles).Run();
+            auto schedule = StageSchedule::Build(
+                TokenPrisoner::GetNPrisonersToVisitAtStages(n_prisoners), n_prisoners,
+                TokenCyclesPhase::MakeScheduleShape(n_cycles));
+            if (not schedule.IsOver(days - 1)) {
+                std::swap(generator, rng::GetGenerator());
+                auto token_prisoner_days = Prison<TokenPrisoner>(n_prisoners).Run();
+                assert(days == token_prisoner_days and rng::GetGenerator() == generator);
+            }
+        }
+    }
+
+    for (int32_t n_prisoners : {1, 2, 3, 10, 50}) {
+        Prison<RegisterTokenPrisoner<2>>(n_prisoners).Run();
+        Prison<RegisterTokenPrisoner<3>>(n_prisoners).Run();
+        Prison<RegisterTokenPrisoner<16>>(n_prisoners).Run();
+    }
+
+    for (int32_t n_levels = 1; n_levels <= 3; ++n_levels) {
+        for (int32_t n_prisoners : {1, 2, 3, 10, 50}) {
+            auto quotas = HierarchicalCounterPrisoner::ComputeDefaultQuotas(n_prisoners, n_levels);
+            Prison<HierarchicalCounterPrisoner>(n_prisoners, quotas).Run();
+        }
+    }
+
+    FramePool frame_pool;
+    for (auto prisoner_coroutine :
+         {DedicatedCounterPrisonerCoroutine, DynamicCounterPrisonerCoroutine}) {
+        for (int32_t n_prisoners : {1, 2, 3, 50}) {
+            CoroutinePrison(prisoner_coroutine, n_prisoners, frame_pool).Run();
+        }
+        assert(CoroutinePrison(prisoner_coroutine, 1, frame_pool).Run() == 1);
+    }
+}
+}  // namespace test
+
+// What a simulation reports to the driver.
+struct SimulationResult {
+    double days = 0;
+    // The day on which the last prisoner first entered the room, the coupon collector's time,
+    // which serves as a control variate for the days.
+    double all_visited_days = 0;
+    // Stopped at a deadline, so the days are those so far and the simulation would take more.
+    bool is_censored = false;
+    // Loaded from the results store rather than simulated by this run.
+    bool is_stored = false;
+};
+
+// Stores the results of seeded simulations on disk, in blocks of kBlockSize consecutive
+// simulations. A block's file is named by the hash of its key, which holds everything its days
+// depend on, and starts with the key itself to guard against collisions. Blocks may be partial,
+// later runs extend them.
+class ResultsStore {
+public:
+    // Bump when a change to the simulation makes stored results stale.
+    static constexpr int32_t kEngineVersion = 4;
+    static constexpr int64_t kBlockSize = 1024;
+
+    explicit ResultsStore(std::filesystem::path directory) : directory{std::move(directory)} {
+        std::filesystem::create_directories(this->directory);
+    }
+
+    static std::string MakeBlockKey(const std::string &strategy_key, int32_t n_prisoners,
+                                    uint64_t seed, int64_t block_index) {
+        std::ostringstream oss;
+        oss << "engine " << kEngineVersion << " prisoners " << n_prisoners << " seed " << seed
+            << " block " << block_index << '/' << kBlockSize << " strategy " << strategy_key;
+        return oss.str();
+    }
+
+    std::vector<SimulationResult> Load(const std::string &key) const {
+        std::ifstream file{GetPath(key)};
+        std::string stored_key;
+        std::vector<SimulationResult> results;
+        if (not std::getline(file, stored_key) or stored_key != Escape(key)) {
+            return results;
+        }
+        for (SimulationResult result; file >> result.days >> result.all_visited_days;) {
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    void Save(const std::string &key, const std::vector<SimulationResult> &results) const {
+        auto path = GetPath(key);
+        auto temporary_path = path;
+        temporary_path += ".tmp" + std::to_string(rng::GetDevice()());
+        {
+            std::ofstream file{temporary_path};
+            file.precision(std::numeric_limits<double>::max_digits10);
+            file << Escape(key) << '\n';
+            for (const auto &result : results) {
+                file << result.days << ' ' << result.all_visited_days << '\n';
+            }
+            if (not file) {
+                throw std::runtime_error{"Cannot write results store block."};
+            }
+        }
+        std::filesystem::rename(temporary_path, path);
+    }
+
+    std::filesystem::path directory;
+
+private:
+    static std::string Escape(std::string key) {
+        std::replace(key.begin(), key.end(), '\n', ' ');
+        return key;
+    }
+
+    std::filesystem::path GetPath(const std::string &key) const {
+        // 64-bit FNV-1a, which unlike std::hash is the same in every build.
+        uint64_t hash = 14695981039346656037ull;
+        for (auto c : key) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        std::ostringstream oss;
+        oss << std::hex << hash << ".days";
+        return directory / oss.str();
+    }
+};
+
+struct SimulationOptions {
+    int32_t n_threads = parallel::GetNThreads();
+    // Pins worker i to a CPU of NUMA node i % n_nodes, so that the prisons it builds are
+    // first touched, and so allocated, on that node.
+    bool pin_threads = false;
+    // Seeds the generator of simulation i with seed + i, so that runs of different strategies
+    // with the same seed are paired on common random numbers.
+    std::optional<uint64_t> seed;
+    int32_t n_bootstrap_resamples = 1000;
+    // When set, seeded runs reuse the days stored there and only simulate the rest.
+    std::optional<std::filesystem::path> results_store_directory;
+    // Identifies the strategy and its parameters in the results store.
+    std::string strategy_key;
+    int32_t n_prisoners = 0;
+    // When set, workers stop starting simulations once the budget is spent, so fewer than the
+    // requested simulations may be done. Simulations in flight at the deadline still finish.
+    std::optional<std::chrono::milliseconds> time_budget;
+    // When set, seeded runs of prison strategies draw their visitors on producer threads,
+    // n_producer_threads of the threads or the split of them that runs fastest.
+    bool pipeline = false;
+    std::optional<int32_t> n_producer_threads;
+    // When above 1, each worker of a prison strategy runs that many prisons at once, a day of
+    // each in turn, see RunInterleavedSimulationRangeInParallel.
+    int32_t n_interleaved_prisons = 1;
+};
+
+int32_t GetNWorkers(int64_t n_simulations, const SimulationOptions &options) {
+    return static_cast<int32_t>(
+        std::clamp<int64_t>(options.n_threads, 1, std::max<int64_t>(1, n_simulations)));
+}
+
+std::vector<std::vector<int32_t>> GetWorkerNodeCpus(const SimulationOptions &options) {
+    return options.pin_threads ? numa::GetNodeCpus() : std::vector<std::vector<int32_t>>(1);
+}
+
+// The pin lasts as long as the returned object.
+[[nodiscard]] numa::ScopedCpuPin PinWorker(int32_t worker,
+                                           const std::vector<std::vector<int32_t>> &node_cpus,
+                                           const SimulationOptions &options) {
+    if (not options.pin_threads) {
+        return numa::ScopedCpuPin{std::nullopt};
+    }
+    auto n_nodes = static_cast<int32_t>(node_cpus.size());
+    const auto &cpus = node_cpus[worker % n_nodes];
+    return numa::ScopedCpuPin{cpus[worker / n_nodes % cpus.size()]};
+}
+
+// Runs simulations first_simulation, ..., first_simulation + n_simulations - 1 on the option's
+// workers and calls consume(worker, i, result) for simulation first_simulation + i on the worker
+// that ran it. Worker w runs a contiguous slice of the simulations.
+template <class RunSimulation, class Consume>
+void ForEachSimulationInParallel(int64_t first_simulation, int64_t n_simulations,
+                                 const SimulationOptions &options, RunSimulation &run_simulation,
+                                 Consume consume) {
+    auto node_cpus = GetWorkerNodeCpus(options);
+    auto n_threads = GetNWorkers(n_simulations, options);
+
+    parallel::ForEachIndex(n_threads, n_threads, [&](int32_t worker) {
+        auto pin = PinWorker(worker, node_cpus, options);
+        rng::ScopedGeneratorState generator_state{options.seed.has_value()};
+
+        auto end = n_simulations * (worker + 1) / n_threads;
+        for (auto i = n_simulations * worker / n_threads; i < end; ++i) {
+            if (options.seed) {
+                rng::GetGenerator().seed(
+                    static_cast<std::mt19937::result_type>(*options.seed + first_simulation + i));
+            }
+            consume(worker, i, run_simulation());
+        }
+    });
+}
+
+// Writes the results of the simulations into results, which must hold n_simulations values.
+// Workers write their slices in place, so there is nothing to merge.
+template <class RunSimulation>
+void RunSimulationRangeInParallel(int64_t first_simulation, int64_t n_simulations,
+                                  const SimulationOptions &options,
+                                  RunSimulation &run_simulation,
+                                  std::span<SimulationResult> results) {
+    assert(static_cast<int64_t>(results.size()) >= n_simulations);
+    ForEachSimulationInParallel(
+        first_simulation, n_simulations, options, run_simulation,
+        [results](int32_t, int64_t i, SimulationResult result) { results[i] = result; });
+}
+
+// Writes the results of the simulations into results like RunSimulationRangeInParallel, with
+// n_producers more threads drawing the visitors of the workers' simulations ahead of them, so
+// that the workers only move prisoners. The results are those of the seeded run.
+template <class RunPipelinedSimulation>
+void RunPipelinedSimulationRangeInParallel(int64_t first_simulation, int64_t n_simulations,
+                                           const SimulationOptions &options, int32_t n_producers,
+                                           RunPipelinedSimulation &run_pipelined_simulation,
+                                           std::span<SimulationResult> results) {
+    assert(options.seed and n_producers > 0);
+    assert(static_cast<int64_t>(results.size()) >= n_simulations);
+    auto node_cpus = GetWorkerNodeCpus(options);
+    auto n_consumers = static_cast<int32_t>(std::clamp<int64_t>(
+        options.n_threads - n_producers, 1, std::max<int64_t>(1, n_simulations)));
+    n_producers = std::min(n_producers, n_consumers);
+
+    std::vector<pipeline::BlockRing> rings(n_consumers);
+    std::vector<std::vector<pipeline::BlockRing *>> producer_rings(n_producers);
+    for (int32_t consumer = 0; consumer < n_consumers; ++consumer) {
+        producer_rings[consumer % n_producers].push_back(&rings[consumer]);
+    }
+    std::vector<std::jthread> producers;
+    for (int32_t producer = 0; producer < n_producers; ++producer) {
+        producers.emplace_back([&, producer] {
+            auto pin = PinWorker(n_consumers + producer, node_cpus, options);
+            pipeline::Produce(producer_rings[producer], options.n_prisoners,
+                              *options.seed + first_simulation);
+        });
+    }
+    // Producers stop once every ring is finished, also when a simulation throws.
+    auto finish_rings = [&] {
+        for (auto &ring : rings) {
+            ring.consumer_is_finished.store(true, std::memory_order_release);
+        }
+    };
+    try {
+        parallel::ForEachIndex(n_consumers, n_consumers, [&](int32_t consumer) {
+            auto pin = PinWorker(consumer, node_cpus, options);
+            auto end = n_simulations * (consumer + 1) / n_consumers;
+            for (auto i = n_simulations * consumer / n_consumers; i < end; ++i) {
+                results[i] = run_pipelined_simulation(rings[consumer], i);
+            }
+            rings[consumer].consumer_is_finished.store(true, std::memory_order_release);
+        });
+    } catch (...) {
+        finish_rings();
+        throw;
+    }
+    finish_rings();
+}
+
+// Runs n_simulations seeded simulations with n_producer_threads producers, or with each
+// candidate split of the threads on a prefix of the simulations and then the fastest one on
+// the rest. No producers means the visitors are drawn inline. Returns the results in order of
+// simulations and sets n_producers to the split that ran the rest.
+template <class RunPipelinedSimulation, class RunSimulation>
+std::vector<SimulationResult> RunSimulationsPipelined(
+    int32_t n_simulations, const SimulationOptions &options,
+    RunPipelinedSimulation &run_pipelined_simulation, RunSimulation &run_simulation,
+    int32_t &n_producers) {
+    assert(options.seed);
+    std::vector<SimulationResult> results(n_simulations);
+    int64_t n_done = 0;
+    auto run_next = [&](int64_t n, int32_t n_producers_to_run) {
+        auto range = std::span(results).subspan(n_done, n);
+        if (n_producers_to_run == 0) {
+            RunSimulationRangeInParallel(n_done, n, options, run_simulation, range);
+        } else {
+            RunPipelinedSimulationRangeInParallel(n_done, n, options, n_producers_to_run,
+                                                  run_pipelined_simulation, range);
+        }
+        n_done += n;
+    };
+
+    std::vector<int32_t> candidates = {options.n_producer_threads.value_or(0)};
+    if (not options.n_producer_threads) {
+        for (auto n_candidate : {options.n_threads / 4, options.n_threads / 3,
+                                 options.n_threads / 2}) {
+            if (n_candidate > candidates.back()) {
+                candidates.push_back(n_candidate);
+            }
+        }
+    }
+    n_producers = candidates.front();
+    // Each candidate runs a twentieth of the simulations, but at least a few per thread.
+    auto n_calibration_simulations = std::min<int64_t>(
+        n_simulations / (2 * static_cast<int64_t>(candidates.size())),
+        std::max<int64_t>(n_simulations / 20, 16 * options.n_threads));
+    if (candidates.size() > 1 and n_calibration_simulations > 0) {
+        // Days per second rather than simulations per second, as the days vary a lot.
+        double best_days_per_second = 0;
+        for (auto n_candidate : candidates) {
+            auto first = n_done;
+            auto start = std::chrono::steady_clock::now();
+            run_next(n_calibration_simulations, n_candidate);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            double days = 0;
+            for (auto i = first; i < n_done; ++i) {
+                days += results[i].days;
+            }
+            if (days / seconds.count() > best_days_per_second) {
+                best_days_per_second = days / seconds.count();
+                n_producers = n_candidate;
+            }
+        }
+    }
+    run_next(n_simulations - n_done, n_producers);
+    return results;
+}
+
+// Writes the results of the simulations into results like RunSimulationRangeInParallel, with
+// each worker running n_interleaved prisons of its slice at once, a day of each in turn. Every
+// day prefetches the prisoner of its prison's next day, so that with prisons too large for the
+// caches, the misses of the other prisons' days are in flight while one prison takes its day.
+// Prison i draws from its own generator seeded like simulation i, so seeded days are unchanged.
+template <class Prisoner, class... PrisonerArgs>
+void RunInterleavedSimulationRangeInParallel(int64_t first_simulation, int64_t n_simulations,
+                                             const SimulationOptions &options,
+                                             int32_t n_interleaved,
+                                             std::span<SimulationResult> results,
+                                             const PrisonerArgs &...prisoner_args) {
+    using InterleavedPrison = Prison<Prisoner, LookaheadVisitors>;
+    assert(static_cast<int64_t>(results.size()) >= n_simulations);
+    auto node_cpus = GetWorkerNodeCpus(options);
+    auto n_threads = GetNWorkers(n_simulations, options);
+
+    parallel::ForEachIndex(n_threads, n_threads, [&](int32_t worker) {
+        auto pin = PinWorker(worker, node_cpus, options);
+
+        struct Lane {
+            std::optional<InterleavedPrison> prison;
+            int64_t simulation = 0;
+        };
+        auto next_simulation = n_simulations * worker / n_threads;
+        auto end = n_simulations * (worker + 1) / n_threads;
+        auto start_next_simulation = [&](Lane &lane) {
+            if (next_simulation == end) {
+                lane.prison.reset();
+                return false;
+            }
+            lane.simulation = next_simulation++;
+            auto &prison = lane.prison.emplace(options.n_prisoners, prisoner_args...);
+            prison.visitors.generator.seed(
+                options.seed ? static_cast<std::mt19937::result_type>(
+                                   *options.seed + first_simulation + lane.simulation)
+                             : rng::GetGenerator()());
+            prison.PrefetchNextDay();
+            return true;
+        };
+
+        std::vector<Lane> lanes(std::clamp<int64_t>(n_interleaved, 1, end - next_simulation));
+        for (auto &lane : lanes) {
+            start_next_simulation(lane);
+        }
+        for (auto n_running = lanes.size(); n_running > 0;) {
+            for (auto &lane : lanes) {
+                if (not lane.prison) {
+                    continue;
+                }
+                auto &prison = *lane.prison;
+                if (prison.NextDay() == PrisonerClaim::claim_that_everyone_has_been_in_the_room) {
+                    if (not prison.HaveAllPrisonersBeenInTheRoom()) {
+                        throw FalsePrisonerClaimException{};
+                    }
+                    results[lane.simulation] = {static_cast<double>(prison.day_number),
+                                                static_cast<double>(prison.all_visited_day_number)};
+                    if (not start_next_simulation(lane)) {
+                        --n_running;
+                    }
+                } else {
+                    prison.PrefetchNextDay();
+                }
+            }
+        }
+    });
+}
+
+namespace test {
+// Seeded simulations take the same days however the drivers run them.
+template <class Prisoner>
+void TestSimulationDrivers() {
+    constexpr int64_t kNSimulations = 20;
+    for (int32_t n_prisoners : {1, 2, 10, 50}) {
+        SimulationOptions options;
+        options.n_threads = 4;
+        options.seed = 1;
+        options.n_prisoners = n_prisoners;
+        auto run_simulation = [n_prisoners] { return RunPrison(Prison<Prisoner>(n_prisoners)); };
+        std::vector<SimulationResult> results(kNSimulations);
+        RunSimulationRangeInParallel(0, kNSimulations, options, run_simulation, results);
+
+        auto run_pipelined_simulation = [n_prisoners](pipeline::BlockRing &ring,
+                                                      int64_t simulation) {
+            Prison<Prisoner, pipeline::RingVisitors> prison(n_prisoners);
+            prison.visitors = pipeline::RingVisitors(ring, simulation);
+            return RunPrison(prison);
+        };
+        for (int32_t n_producers : {1, 2}) {
+            std::vector<SimulationResult> pipelined_results(kNSimulations);
+            RunPipelinedSimulationRangeInParallel(0, kNSimulations, options, n_producers,
+                                                  run_pipelined_simulation, pipelined_results);
+            for (int64_t i = 0; i < kNSimulations; ++i) {
+                assert(pipelined_results[i].days == results[i].days);
+            }
+        }
+
+        for (int32_t n_interleaved : {1, 3, 8}) {
+            std::vector<SimulationResult> interleaved_results(kNSimulations);
+            RunInterleavedSimulationRangeInParallel<Prisoner>(0, kNSimulations, options,
+                                                              n_interleaved, interleaved_results);
+            for (int64_t i = 0; i < kNSimulations; ++i) {
+                assert(interleaved_results[i].days == results[i].days and
+                       interleaved_results[i].all_visited_days == results[i].all_visited_days);
+            }
+        }
+    }
+}
+}  // namespace test
+
+// Runs simulations 0, 1, ... on the option's workers until n_simulations have started or the
+// deadline has passed, and returns the results of the started simulations in order of
+// simulations, which are censored if run_simulation_until(deadline) stopped them. Workers take
+// the next simulation from a shared counter, as they can't split an unknown count, and check
+// the deadline before taking it, so that the started simulations are 0, 1, ... without gaps.
+template <class RunSimulationUntil>
+std::vector<SimulationResult> RunSimulationsUntilDeadline(
+    int64_t n_simulations, std::chrono::steady_clock::time_point deadline,
+    const SimulationOptions &options, RunSimulationUntil &run_simulation_until) {
+    auto node_cpus = GetWorkerNodeCpus(options);
+    auto n_threads = GetNWorkers(n_simulations, options);
+
+    std::atomic<int64_t> next_simulation = 0;
+    std::vector<std::vector<std::pair<int64_t, SimulationResult>>> worker_results(n_threads);
+    parallel::ForEachIndex(n_threads, n_threads, [&](int32_t worker) {
+        auto pin = PinWorker(worker, node_cpus, options);
+        rng::ScopedGeneratorState generator_state{options.seed.has_value()};
+        // Simulation 0 always starts, so that there is a result to report.
+        while (next_simulation == 0 or std::chrono::steady_clock::now() < deadline) {
+            auto i = next_simulation++;
+            if (i >= n_simulations) {
+                break;
+            }
+            if (options.seed) {
+                rng::GetGenerator().seed(
+                    static_cast<std::mt19937::result_type>(*options.seed + i));
+            }
+            worker_results[worker].emplace_back(i, run_simulation_until(deadline));
+        }
+    });
+
+    std::vector<std::pair<int64_t, SimulationResult>> indexed_results;
+    for (const auto &results_of_worker : worker_results) {
+        indexed_results.insert(indexed_results.end(), results_of_worker.begin(),
+                               results_of_worker.end());
+    }
+    std::sort(indexed_results.begin(), indexed_results.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    std::vector<SimulationResult> results;
+    results.reserve(indexed_results.size());
+    for (const auto &[i, result] : indexed_results) {
+        results.push_back(result);
+    }
+    return results;
+}
+
+// Calls run_simulation() n_simulations times and returns the results of every run in order of
+// simulations. With a results store, only the simulations missing from it are run.
+template <class RunSimulation>
+std::vector<SimulationResult> RunSimulationsInParallel(int32_t n_simulations,
+                                                       const SimulationOptions &options,
+                                                       RunSimulation run_simulation) {
+    if (not options.results_store_directory) {
+        std::vector<SimulationResult> results(n_simulations);
+        RunSimulationRangeInParallel(0, n_simulations, options, run_simulation, results);
+        return results;
+    }
+    assert(options.seed);
+
+    ResultsStore store{*options.results_store_directory};
+    auto block_size = ResultsStore::kBlockSize;
+    auto n_blocks = (n_simulations + block_size - 1) / block_size;
+    std::vector<std::string> block_keys;
+    std::vector<std::vector<SimulationResult>> blocks;
+    std::vector<std::pair<int64_t, int64_t>> missing_ranges;
+    for (int64_t block_index = 0; block_index < n_blocks; ++block_index) {
+        block_keys.push_back(ResultsStore::MakeBlockKey(options.strategy_key, options.n_prisoners,
+                                                        *options.seed, block_index));
+        blocks.push_back(store.Load(block_keys.back()));
+        for (auto &result : blocks.back()) {
+            result.is_stored = true;
+        }
+        auto begin = block_index * block_size + static_cast<int64_t>(blocks.back().size());
+        auto end = std::min<int64_t>(n_simulations, (block_index + 1) * block_size);
+        if (begin >= end) {
+            continue;
+        }
+        if (not missing_ranges.empty() and missing_ranges.back().second == begin) {
+            missing_ranges.back().second = end;
+        } else {
+            missing_ranges.emplace_back(begin, end);
+        }
+    }
+
+    std::vector<bool> blocks_are_extended(n_blocks);
+    for (auto [begin, end] : missing_ranges) {
+        std::vector<SimulationResult> results(end - begin);
+        RunSimulationRangeInParallel(begin, end - begin, options, run_simulation, results);
+        for (auto i = begin; i < end; ++i) {
+            blocks[i / block_size].push_back(results[i - begin]);
+            blocks_are_extended[i / block_size] = true;
+        }
+    }
+
+    std::vector<SimulationResult> results;
+    for (int64_t block_index = 0; block_index < n_blocks; ++block_index) {
+        if (blocks_are_extended[block_index]) {
+            store.Save(block_keys[block_index], blocks[block_index]);
+        }
+        auto n_results = std::min<int64_t>(static_cast<int64_t>(blocks[block_index].size()),
+                                           n_simulations - block_index * block_size);
+        results.insert(results.end(), blocks[block_index].begin(),
+                       blocks[block_index].begin() + n_results);
+    }
+    return results;
+}
+
+struct TailEstimate {
+    // The days exceeded with probability level_probabilities[i] are levels[i].
+    std::vector<int32_t> levels;
+    std::vector<double> level_probabilities;
+    // Pairs of a tail probability and the days exceeded with it, or nullopt if no prisons ran
+    // far enough to resolve it.
+    std::vector<std::pair<double, std::optional<double>>> quantiles;
+};
+
+// The prisons of a splitting stage and the number of simulations they stand for. Past
+// max_n_particles, a uniform sample of them is kept, which bounds the memory of the stage
+// without biasing it.
+template <class SomePrison>
+struct SplittingParticles {
+    std::vector<SomePrison> prisons;
+    int64_t n_particles = 0;
+};
+
+// Runs copies of the particles in turn, the copy of run i on seed first_run + i, for
+// n_particles runs, to the end, and returns their sorted days.
+template <class SomePrison>
+std::vector<double> RunParticlesToTheEnd(const SplittingParticles<SomePrison> &particles,
+                                         int32_t n_particles, int64_t first_run,
+                                         int32_t n_threads, const SimulationOptions &options) {
+    std::vector<double> days(n_particles);
+    parallel::ForEachIndex(n_particles, n_threads, [&](int32_t i) {
+        if (options.seed) {
+            rng::GetGenerator().seed(
+                static_cast<std::mt19937::result_type>(*options.seed + first_run + i));
+        }
+        auto prison = particles.prisons[i % particles.prisons.size()];
+        days[i] = prison.Run();
+    });
+    std::sort(days.begin(), days.end());
+    return days;
+}
+
+// Like RunParticlesToTheEnd, but runs the copies to the level and returns the unfinished ones,
+// a chunk of runs at a time so that at most max_n_particles prisons are kept.
+template <class SomePrison>
+SplittingParticles<SomePrison> RunParticlesToLevel(const SplittingParticles<SomePrison> &particles,
+                                                   int32_t n_particles, int32_t level,
+                                                   int64_t first_run, int32_t n_threads,
+                                                   int64_t max_n_particles,
+                                                   const SimulationOptions &options,
+                                                   std::mt19937 &sampling_generator) {
+    SplittingParticles<SomePrison> unfinished_particles;
+    for (int64_t chunk_start = 0; chunk_start < n_particles; chunk_start += max_n_particles) {
+        auto chunk_size =
+            static_cast<int32_t>(std::min<int64_t>(max_n_particles, n_particles - chunk_start));
+        std::vector<std::optional<SomePrison>> unfinished(chunk_size);
+        parallel::ForEachIndex(chunk_size, n_threads, [&](int32_t i) {
+            if (options.seed) {
+                rng::GetGenerator().seed(static_cast<std::mt19937::result_type>(
+                    *options.seed + first_run + chunk_start + i));
+            }
+            auto prison = particles.prisons[(chunk_start + i) % particles.prisons.size()];
+            if (not prison.RunForAtMost(level)) {
+                unfinished[i] = std::move(prison);
+            }
+        });
+        // Reservoir sampling.
+        for (auto &prison : unfinished) {
+            if (not prison) {
+                continue;
+            }
+            auto particle_index = unfinished_particles.n_particles++;
+            if (particle_index < max_n_particles) {
+                unfinished_particles.prisons.push_back(std::move(*prison));
+            } else if (auto j = std::uniform_int_distribution<int64_t>(0, particle_index)(
+                           sampling_generator);
+                       j < max_n_particles) {
+                unfinished_particles.prisons[j] = std::move(*prison);
+            }
+        }
+    }
+    return unfinished_particles;
+}
+
+// Estimates the tail of the days of initial_prison by fixed effort multilevel splitting. Each
+// stage starts n_particles copies of the prisons that were unfinished at the previous level,
+// in turn, and runs them to the next level. A pilot on its own random numbers places the
+// levels, each where about survival_fraction of the prisons of its stage run on past it. The
+// estimate then splits at these fixed levels, so the product of the unfinished fractions is an
+// unbiased estimate of the probability of exceeding each level. The quantiles come from
+// running the prisons of a stage to the end, and are consistent, not unbiased.
+template <class SomePrison>
+TailEstimate EstimateTailBySplitting(const SomePrison &initial_prison, int32_t n_particles,
+                                     const std::vector<double> &tail_probabilities,
+                                     const SimulationOptions &options,
+                                     double survival_fraction = 0.1) {
+    assert(n_particles > 0 and not tail_probabilities.empty());
+    // The prisoners take most of a prison, which the particles of a stage hold at most 256 MiB
+    // of.
+    constexpr int64_t kMaxParticlesBytes = int64_t{1} << 28;
+    auto prison_bytes = static_cast<int64_t>(
+        sizeof(SomePrison) +
+        initial_prison.prisoners.size() * (sizeof(initial_prison.prisoners[0]) + 1));
+    auto max_n_particles = std::max<int64_t>(1, kMaxParticlesBytes / prison_bytes);
+    auto n_threads = GetNWorkers(n_particles, options);
+    std::mt19937 sampling_generator(options.seed ? *options.seed : rng::GetDevice()());
+    int64_t next_run = 0;
+
+    auto sorted_tail_probabilities = tail_probabilities;
+    std::sort(sorted_tail_probabilities.rbegin(), sorted_tail_probabilities.rend());
+    std::vector<int32_t> levels;
+    SplittingParticles<SomePrison> particles{{initial_prison}, 1};
+    double probability = 1;
+    while (probability * survival_fraction >= sorted_tail_probabilities.back()) {
+        auto days = RunParticlesToTheEnd(particles, n_particles, next_run, n_threads, options);
+        next_run += n_particles;
+        auto level = static_cast<int32_t>(stats::Quantile(days, 1 - survival_fraction));
+        if (days.back() <= level) {
+            break;
+        }
+        particles = RunParticlesToLevel(particles, n_particles, level, next_run, n_threads,
+                                        max_n_particles, options, sampling_generator);
+        next_run += n_particles;
+        if (particles.n_particles == 0) {
+            break;
+        }
+        probability *= static_cast<double>(particles.n_particles) / n_particles;
+        levels.push_back(level);
+    }
+
+    TailEstimate estimate;
+    estimate.levels = levels;
+    auto next_tail_probability = sorted_tail_probabilities.begin();
+    particles = {{initial_prison}, 1};
+    probability = 1;
+    for (size_t stage = 0; stage <= levels.size(); ++stage) {
+        auto days = RunParticlesToTheEnd(particles, n_particles, next_run, n_threads, options);
+        next_run += n_particles;
+        auto next_probability = 0.0;
+        if (stage < levels.size()) {
+            particles = RunParticlesToLevel(particles, n_particles, levels[stage], next_run,
+                                            n_threads, max_n_particles, options,
+                                            sampling_generator);
+            next_run += n_particles;
+            next_probability =
+                probability * static_cast<double>(particles.n_particles) / n_particles;
+        }
+        for (; next_tail_probability != sorted_tail_probabilities.end() and
+               (stage == levels.size() or *next_tail_probability >= next_probability);
+             ++next_tail_probability) {
+            // Tails thinner than one prison of the stage are beyond its days.
+            auto conditional_tail_probability = *next_tail_probability / probability;
+            if (conditional_tail_probability * n_particles < 1) {
+                estimate.quantiles.emplace_back(*next_tail_probability, std::nullopt);
+            } else {
+                estimate.quantiles.emplace_back(
+                    *next_tail_probability,
+                    stats::Quantile(days, 1 - conditional_tail_probability));
+            }
+        }
+        if (stage == levels.size()) {
+            break;
+        }
+        probability = next_probability;
+        estimate.level_probabilities.push_back(probability);
+        if (particles.n_particles == 0) {
+            // No prison got past the level, so the later levels are exceeded with estimated
+            // probability 0, and the smaller tail probabilities are out of reach.
+            estimate.level_probabilities.resize(levels.size());
+            for (; next_tail_probability != sorted_tail_probabilities.end();
+                 ++next_tail_probability) {
+                estimate.quantiles.emplace_back(*next_tail_probability, std::nullopt);
+            }
+            break;
+        }
+    }
+    return estimate;
+}
+
+namespace test {
+// On a small seeded prison, the levels rise while their probabilities fall, the first level's
+// probability agrees with plain sampling, and every resolved quantile lies between the levels
+// around its tail probability. The quantiles come from other runs than the probabilities, so
+// only levels well past the tail probability bound them from above.
+template <class Prisoner>
+void TestTailSplitting() {
+    constexpr int32_t kNPrisoners = 10;
+    constexpr int32_t kNParticles = 1000;
+    constexpr int32_t kNPlainSimulations = 10000;
+    rng::ScopedGeneratorState generator_state{true};
+    SimulationOptions options;
+    options.n_threads = 2;
+    options.seed = 1;
+    auto estimate = EstimateTailBySplitting(Prison<Prisoner>(kNPrisoners), kNParticles,
+                                            {1e-2, 1e-3}, options);
+    assert(estimate.levels.size() == estimate.level_probabilities.size());
+    for (size_t i = 0; i < estimate.levels.size(); ++i) {
+        assert(estimate.level_probabilities[i] > 0 and estimate.level_probabilities[i] < 1);
+        assert(i == 0 or (estimate.levels[i] > estimate.levels[i - 1] and
+                          estimate.level_probabilities[i] < estimate.level_probabilities[i - 1]));
+    }
+
+    if (not estimate.levels.empty()) {
+        int32_t n_exceeding = 0;
+        for (int32_t i = 0; i < kNPlainSimulations; ++i) {
+            rng::GetGenerator().seed(static_cast<std::mt19937::result_type>(i));
+            n_exceeding += Prison<Prisoner>(kNPrisoners).Run() > estimate.levels[0];
+        }
+        // Four standard deviations of the difference.
+        auto probability = static_cast<double>(n_exceeding) / kNPlainSimulations;
+        [[maybe_unused]] auto tolerance =
+            4 * std::sqrt(probability * (1 - probability) *
+                          (1.0 / kNParticles + 1.0 / kNPlainSimulations));
+        assert(std::abs(estimate.level_probabilities[0] - probability) < tolerance);
+    }
+
+    for ([[maybe_unused]] const auto &[tail_probability, days] : estimate.quantiles) {
+        if (not days) {
+            continue;
+        }
+        for (size_t i = 0; i < estimate.levels.size(); ++i) {
+            if (estimate.level_probabilities[i] > tail_probability) {
+                assert(*days > estimate.levels[i]);
+            } else if (estimate.level_probabilities[i] < tail_probability / 2) {
+                assert(*days <= estimate.levels[i]);
+            }
+        }
+    }
+}
+}  // namespace test
+
+void PrintTailEstimate(const TailEstimate &estimate, int32_t n_particles) {
+    std::cout << "Tail by multilevel splitting, " << n_particles
+              << " prisons per level, levels from a pilot run:";
+    for (size_t i = 0; i < estimate.levels.size(); ++i) {
+        std::cout << "\nP(days > " << estimate.levels[i] << "), unbiased:\t"
+                  << estimate.level_probabilities[i];
+    }
+    for (const auto &[tail_probability, days] : estimate.quantiles) {
+        std::cout << "\nDays exceeded with probability " << tail_probability << ":\t";
+        if (days) {
+            std::cout << *days;
+        } else {
+            std::cout << "unresolved, too few prisons got that far";
+        }
+    }
+}
+
+void PrintDaysStatistics(const std::vector<double> &days_prison_ran_for,
+                         const SimulationOptions &options = {}) {
+    auto n_simulations = static_cast<int32_t>(days_prison_ran_for.size());
+    double days_mean =
+        std::reduce(days_prison_ran_for.begin(), days_prison_ran_for.end()) / n_simulations;
+    double days_std = 0;
+    for (auto i : days_prison_ran_for) {
+        days_std += (i - days_mean) * (i - days_mean);
+    }
+    days_std = std::sqrt(days_std / n_simulations);
+
+    std::cout << "Days mean:\t" << static_cast<int32_t>(days_mean);
+    std::cout << "\nDays std:\t" << days_std;
+
+    auto sorted_days = days_prison_ran_for;
+    std::sort(sorted_days.begin(), sorted_days.end());
+    std::vector<std::pair<std::string, double>> quantiles{
+        {"median", 0.5}, {"p90", 0.9}, {"p99", 0.99}};
+    std::vector<double> quantile_values;
+    for (const auto &[name, quantile] : quantiles) {
+        quantile_values.push_back(quantile);
+    }
+    auto intervals = stats::BootstrapQuantileIntervals(
+        days_prison_ran_for, quantile_values, 0.95, options.n_bootstrap_resamples,
+        options.n_threads, options.seed.value_or(0));
+    for (size_t i = 0; i < quantiles.size(); ++i) {
+        std::cout << "\nDays " << quantiles[i].first << ":\t"
+                  << stats::Quantile(sorted_days, quantiles[i].second) << "\t95% CI ["
+                  << intervals[i].lower << ", " << intervals[i].upper << ']';
+    }
+}
+
+// Prints how many simulations finished within the time budget, and how many were stopped at
+// the deadline. The finished ones are biased toward short simulations when many are stopped.
+void PrintTimeBudgetSummary(const std::vector<double> &days_prison_ran_for,
+                            const std::vector<double> &censored_days,
+                            std::chrono::milliseconds time_budget) {
+    auto n_simulations = static_cast<double>(days_prison_ran_for.size());
+    std::cout << (n_simulations > 0 ? "\n" : "") << "Simulations done:\t" << n_simulations
+              << " within " << time_budget.count() << " ms";
+    if (n_simulations > 1) {
+        auto days_mean =
+            std::reduce(days_prison_ran_for.begin(), days_prison_ran_for.end()) / n_simulations;
+        double days_variance = 0;
+        for (auto days : days_prison_ran_for) {
+            days_variance += (days - days_mean) * (days - days_mean) / n_simulations;
+        }
+        // Normal approximation, which is fine at the thousands of runs a budget usually buys.
+        std::cout << "\tDays mean 95% CI width "
+                  << 2 * 1.96 * std::sqrt(days_variance / n_simulations);
+    }
+    if (not censored_days.empty()) {
+        std::cout << "\nCensored at the deadline:\t" << censored_days.size()
+                  << " simulations, all longer than "
+                  << *std::min_element(censored_days.begin(), censored_days.end()) << " days";
+    }
+}
+
+// Prints the mean days corrected by the all-visited days, whose mean is known exactly, and how
+// much that narrows the interval of the plain mean.
+void PrintControlVariateMean(const std::vector<SimulationResult> &results, int32_t n_prisoners) {
+    std::vector<double> days;
+    std::vector<double> all_visited_days;
+    for (const auto &result : results) {
+        days.push_back(result.days);
+        all_visited_days.push_back(result.all_visited_days);
+    }
+    auto estimate = stats::ControlVariateMean(days, all_visited_days,
+                                              stats::CouponCollectorMean(n_prisoners));
+    std::cout << "\nDays mean with all-visited control:\t" << estimate.mean << "\t95% CI width "
+              << 2 * 1.96 * estimate.std << "\tvariance reduction "
+              << 100 * estimate.variance_reduction << '%';
+}
+
+// Tests whether the days of strategy a differ from the days of strategy b. The paired test is
+// only meaningful when both ran on the same seed.
+void PrintDaysComparison(const std::vector<double> &a, const std::vector<double> &b,
+                         const SimulationOptions &options) {
+    auto mann_whitney = stats::MannWhitneyUTest(a, b);
+    std::cout << "\nMann-Whitney P(a > b):\t" << mann_whitney.statistic << "\tp-value "
+              << mann_whitney.p_value;
+    auto kolmogorov_smirnov = stats::KolmogorovSmirnovTest(a, b);
+    std::cout << "\nKolmogorov-Smirnov D:\t" << kolmogorov_smirnov.statistic << "\tp-value "
+              << kolmogorov_smirnov.p_value;
+    if (options.seed and a.size() == b.size()) {
+        auto wilcoxon = stats::WilcoxonSignedRankTest(a, b);
+        std::cout << "\nPaired mean a - b:\t" << wilcoxon.statistic
+                  << "\tWilcoxon signed-rank p-value " << wilcoxon.p_value;
+    }
+}
+
+void RunStrategyTableSearch(const StrategyTableSearchConfig &config, int32_t n_generations,
+                            const std::string &checkpoint_path) {
+
+    test::TestStrategyTables();
+
+    auto search = StrategyTableSearch{config};
+    if (checkpoint_path.empty() or not search.LoadCheckpoint(checkpoint_path)) {
+        search.InitializePopulation();
+    }
+
+    while (search.generation < n_generations) {
+        search.NextGeneration();
+        if (not checkpoint_path.empty()) {
+            search.SaveCheckpoint(checkpoint_path);
+        }
+        std::cout << "Generation " << search.generation << ":\tbest days mean "
+                  << search.GetBest().days_mean << ", safe candidates "
+                  << search.GetNSafeCandidates() << '/' << search.population.size() << '\n';
+    }
+
+    const auto &best = search.GetBest();
+    std::vector<double> days_prison_ran_for;
+    for (int32_t i = 0; i < config.n_evaluation_simulations; ++i) {
+        days_prison_ran_for.push_back(
+            TablePrison(best.table, config.n_prisoners).RunForAtMost(search.GetMaxNDays())
+                .value_or(search.GetMaxNDays()));
+    }
+    std::cout << "Best strategy table:\n";
+    best.table.Write(std::cout);
+    std::cout << "On new seeds:\n";
+    PrintDaysStatistics(days_prison_ran_for);
+}
+
+// A strategy resolved from its prisoner class name, so that dispatching on the name happens
+// once per run rather than once per simulation.
+struct Strategy {
+    // Identifies the strategy and its parameters in the results store.
+    std::string key;
+    std::function<void()> self_test;
+    std::function<SimulationResult()> run_simulation;
+    // Like run_simulation, but stops the prison once the deadline has passed, with its days so
+    // far censored. Empty for strategies whose prisons can't be stopped mid-run.
+    std::function<SimulationResult(std::chrono::steady_clock::time_point deadline)>
+        run_simulation_until{};
+    // Runs simulation i on visitors drawn ahead by a producer, see RunSimulationsPipelined.
+    // Empty for strategies whose prisons draw in their own way.
+    std::function<SimulationResult(pipeline::BlockRing &ring, int64_t simulation)>
+        run_pipelined_simulation{};
+    // Runs the simulations from first_simulation on into results, see
+    // RunInterleavedSimulationRangeInParallel. Empty like run_pipelined_simulation.
+    std::function<void(int64_t first_simulation, std::span<SimulationResult> results,
+                       const SimulationOptions &options)>
+        run_interleaved_simulations{};
+    // Empty for strategies whose prisons can't be copied mid-run.
+    std::function<TailEstimate(int32_t n_particles, const std::vector<double> &tail_probabilities,
+                               const SimulationOptions &options)>
+        estimate_tail{};
+};
+
+template <class SomePrison>
+SimulationResult RunPrison(SomePrison &&prison) {
+    auto days = prison.Run();
+    return {static_cast<double>(days), static_cast<double>(prison.all_visited_day_number)};
+}
+
+// Runs the prison a slice of days at a time, until it is over or the deadline has passed.
+template <class SomePrison>
+SimulationResult RunPrisonUntil(SomePrison &&prison,
+                                std::chrono::steady_clock::time_point deadline) {
+    constexpr int64_t kNDaysPerDeadlineCheck = 1 << 16;
+    while (true) {
+        auto max_n_days = static_cast<int32_t>(
+            std::min<int64_t>(prison.day_number + kNDaysPerDeadlineCheck,
+                              std::numeric_limits<int32_t>::max()));
+        if (auto days = prison.RunForAtMost(max_n_days)) {
+            return {static_cast<double>(*days),
+                    static_cast<double>(prison.all_visited_day_number)};
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return {static_cast<double>(prison.day_number),
+                    static_cast<double>(prison.all_visited_day_number), true};
+        }
+    }
+}
+
+// Writes the constructor arguments of a strategy's prisoners into its key, so that strategies
+// with other parameters, or with changed defaults, don't share stored days.
+void WriteStrategyParameter(std::ostream &os, int32_t value) {
+    os << value;
+}
+
+void WriteStrategyParameter(std::ostream &os, double value) {
+    os << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+}
+
+template <class T>
+void WriteStrategyParameter(std::ostream &os, const std::vector<T> &values) {
+    os << '[';
+    for (size_t i = 0; i < values.size(); ++i) {
+        os << (i > 0 ? " " : "");
+        WriteStrategyParameter(os, values[i]);
+    }
+    os << ']';
+}
+
+void WriteStrategyParameter(std::ostream &os, const StageScheduleShape &shape) {
+    os << "{stage_probability ";
+    WriteStrategyParameter(os, shape.stage_probability);
+    os << " stage_probabilities ";
+    WriteStrategyParameter(os, shape.stage_probabilities);
+    os << " after_first_cycle_stage_length_multiplier ";
+    WriteStrategyParameter(os, shape.after_first_cycle_stage_length_multiplier);
+    os << " per_cycle_stage_length_ratio ";
+    WriteStrategyParameter(os, shape.per_cycle_stage_length_ratio);
+    os << " explicit_cycle_stage_lengths ";
+    WriteStrategyParameter(os, shape.explicit_cycle_stage_lengths);
+    os << " max_n_cycles " << shape.max_n_cycles << '}';
+}
+
+// Prisoners are constructed with (prisoner_id, n_prisoners, prisoner_args...), and the key is
+// the name followed by the arguments.
+template <class Prisoner, class... PrisonerArgs>
+Strategy MakePrisonStrategy(const std::string &name, int32_t n_prisoners,
+                            const PrisonerArgs &...prisoner_args) {
+    std::ostringstream key;
+    key << name;
+    if constexpr (sizeof...(prisoner_args) > 0) {
+        key << '(';
+        auto separator = "";
+        ((key << std::exchange(separator, ", "), WriteStrategyParameter(key, prisoner_args)),
+         ...);
+        key << ')';
+    }
+    return {key.str(),
+            [] {
+                test::Test<Prisoner>();
+                test::TestSimulationDrivers<Prisoner>();
+                test::TestTailSplitting<Prisoner>();
+            },
+            [n_prisoners, prisoner_args...] {
+                return RunPrison(Prison<Prisoner>(n_prisoners, prisoner_args...));
+            },
+            [n_prisoners, prisoner_args...](std::chrono::steady_clock::time_point deadline) {
+                return RunPrisonUntil(Prison<Prisoner>(n_prisoners, prisoner_args...), deadline);
+            },
+            [n_prisoners, prisoner_args...](pipeline::BlockRing &ring, int64_t simulation) {
+                Prison<Prisoner, pipeline::RingVisitors> prison(n_prisoners, prisoner_args...);
+                prison.visitors = pipeline::RingVisitors(ring, simulation);
+                return RunPrison(prison);
+            },
+            [prisoner_args...](int64_t first_simulation, std::span<SimulationResult> results,
+                               const SimulationOptions &options) {
+                RunInterleavedSimulationRangeInParallel<Prisoner>(
+                    first_simulation, static_cast<int64_t>(results.size()), options,
+                    options.n_interleaved_prisons, results, prisoner_args...);
+            },
+            [n_prisoners, prisoner_args...](int32_t n_particles,
+                                            const std::vector<double> &tail_probabilities,
+                                            const SimulationOptions &options) {
+                return EstimateTailBySplitting(Prison<Prisoner>(n_prisoners, prisoner_args...),
+                                               n_particles, tail_probabilities, options);
+            }};
+}
+
+Strategy MakeCoroutinePrisonStrategy(const std::string &key,
+                                     PrisonerCoroutine prisoner_coroutine, int32_t n_prisoners) {
+    return {key, test::Test<DedicatedCounterPrisoner>, [prisoner_coroutine, n_prisoners] {
+                thread_local FramePool frame_pool;
+                return RunPrison(CoroutinePrison(prisoner_coroutine, n_prisoners, frame_pool));
+            }};
+}
+
+Strategy MakeTablePrisonStrategy(const std::string &key, StrategyTable table,
+                                 int32_t n_prisoners) {
+    auto shared_table = std::make_shared<const StrategyTable>(std::move(table));
+    return {key, test::TestStrategyTables,
+            [shared_table, n_prisoners] {
+                return RunPrison(TablePrison(*shared_table, n_prisoners));
+            },
+            [shared_table, n_prisoners](std::chrono::steady_clock::time_point deadline) {
+                return RunPrisonUntil(TablePrison(*shared_table, n_prisoners), deadline);
+            }};
+}
+
+namespace test {
+// On the same visitors, a plugin port of a built-in strategy takes its days.
+template <class MakeRunSimulation>
+void TestPortedPluginStrategy(const PrisonersPluginStrategy &plugin_strategy,
+                              MakeRunSimulation make_run_simulation) {
+    rng::ScopedGeneratorState generator_state{true};
+    for (int32_t n_prisoners : {1, 2, 3, 10, 50}) {
+        auto run_simulation = make_run_simulation(n_prisoners);
+        for (std::mt19937::result_type seed = 0; seed < 10; ++seed) {
+            rng::GetGenerator().seed(seed);
+            [[maybe_unused]] auto days = PluginPrison(plugin_strategy, n_prisoners).Run();
+            rng::GetGenerator().seed(seed);
+            [[maybe_unused]] auto ported_days = run_simulation().days;
+            assert(days == ported_days);
+        }
+    }
+}
+}  // namespace test
+
+// Plugin strategies named with this prefix and the name of a built-in strategy port it, and
+// their self-test checks that they take its days.
+constexpr const char *kPortedStrategyPrefix = "Plugin";
+
+// Parameters that don't apply to the strategy are ignored.
+Strategy MakeStrategy(const std::string &prisoner_class_name, int32_t n_prisoners,
+                      const prisoners::StrategyParameters &parameters = {}) {
+    const auto &name = prisoner_class_name;
+    // The parameters are spelled out, so that they are part of the key.
+    auto schedule_shape = StageScheduleShape{};
+    schedule_shape.stage_probability =
+        parameters.stage_probability.value_or(schedule_shape.stage_probability);
+    schedule_shape.after_first_cycle_stage_length_multiplier =
+        parameters.after_first_cycle_stage_length_multiplier.value_or(
+            schedule_shape.after_first_cycle_stage_length_multiplier);
+    schedule_shape.per_cycle_stage_length_ratio = parameters.per_cycle_stage_length_ratio.value_or(
+        schedule_shape.per_cycle_stage_length_ratio);
+    schedule_shape.max_n_cycles = parameters.max_n_cycles.value_or(schedule_shape.max_n_cycles);
+    if (not(schedule_shape.stage_probability > 0 and schedule_shape.stage_probability < 1) or
+        not(schedule_shape.after_first_cycle_stage_length_multiplier > 0) or
+        not(schedule_shape.per_cycle_stage_length_ratio > 0) or schedule_shape.max_n_cycles < 0 or
+        parameters.snowball_stage_length.value_or(1) < 1 or
+        parameters.n_counter_levels.value_or(1) < 1 or parameters.n_token_cycles.value_or(1) < 1) {
+        throw std::invalid_argument{"Invalid strategy parameters."};
+    }
+
+    if (name == "DedicatedCounterPrisoner") {
+        return MakePrisonStrategy<DedicatedCounterPrisoner>(name, n_prisoners);
+    } else if (name == "DynamicCounterPrisoner") {
+        return MakePrisonStrategy<DynamicCounterPrisoner>(
+            name, n_prisoners,
+            parameters.snowball_stage_length.value_or(
+                DynamicCounterPrisoner::ComputeDefaultSnowballStageLength(n_prisoners)));
+    } else if (name == "RegisterTokenPrisoner2") {
+        return MakePrisonStrategy<RegisterTokenPrisoner<2>>(name, n_prisoners, schedule_shape);
+    } else if (name == "RegisterTokenPrisoner4") {
+        return MakePrisonStrategy<RegisterTokenPrisoner<4>>(name, n_prisoners, schedule_shape);
+    } else if (name == "RegisterTokenPrisoner16") {
+        return MakePrisonStrategy<RegisterTokenPrisoner<16>>(name, n_prisoners, schedule_shape);
+    } else if (name == "RegisterTokenPrisoner256") {
+        return MakePrisonStrategy<RegisterTokenPrisoner<256>>(name, n_prisoners, schedule_shape);
+    } else if (name == "HierarchicalCounterPrisoner") {
+        return MakePrisonStrategy<HierarchicalCounterPrisoner>(
+            name, n_prisoners,
+            HierarchicalCounterPrisoner::ComputeDefaultQuotas(
+                n_prisoners, parameters.n_counter_levels.value_or(2)),
+            schedule_shape.stage_probability,
+            schedule_shape.after_first_cycle_stage_length_multiplier);
+    } else if (name == "TokenPrisoner") {
+        if (schedule_shape.max_n_cycles > 0) {
+            return MakePrisonStrategy<TokenThenCounterPrisoner>(name, n_prisoners, schedule_shape);
+        }
+        return MakePrisonStrategy<TokenPrisoner>(name, n_prisoners, schedule_shape);
+    } else if (name == "TokenThenCounterPrisoner") {
+        return MakePrisonStrategy<TokenThenCounterPrisoner>(
+            name, n_prisoners,
+            parameters.n_token_cycles.value_or(TokenCyclesPhase::kDefaultNCycles));
+    } else if (name == "CoroutineDedicatedCounterPrisoner") {
+        return MakeCoroutinePrisonStrategy(name, DedicatedCounterPrisonerCoroutine, n_prisoners);
+    } else if (name == "CoroutineDynamicCounterPrisoner") {
+        return MakeCoroutinePrisonStrategy(name, DynamicCounterPrisonerCoroutine, n_prisoners);
+    } else if (name == "TableDedicatedCounterPrisoner") {
+        return MakeTablePrisonStrategy(name, StrategyTable::MakeDedicatedCounter(n_prisoners),
+                                       n_prisoners);
+    } else if (name.starts_with("table:")) {
+        std::ifstream file{name.substr(std::strlen("table:"))};
+        if (not file) {
+            throw std::invalid_argument{"Cannot open strategy table file."};
+        }
+        auto table = StrategyTable::Parse(file);
+        // Tables are stored by content, so that edited files don't reuse stale days.
+        std::ostringstream oss;
+        table.Write(oss);
+        return MakeTablePrisonStrategy("table " + oss.str(), std::move(table), n_prisoners);
+    } else if (plugins::GetStrategies().contains(name)) {
+        const auto &[plugin_strategy, key] = plugins::GetStrategies().at(name);
+        // Plugins can't be tested by the host beyond its checks of their claims, unless they
+        // port a built-in strategy.
+        std::function<void()> self_test = [] {};
+        if (name.starts_with(kPortedStrategyPrefix)) {
+            auto ported_name = name.substr(std::strlen(kPortedStrategyPrefix));
+            try {
+                MakeStrategy(ported_name, 1);
+                self_test = [plugin_strategy, ported_name] {
+                    test::TestPortedPluginStrategy(*plugin_strategy, [&](int32_t n_prisoners) {
+                        return MakeStrategy(ported_name, n_prisoners).run_simulation;
+                    });
+                };
+            } catch (const std::invalid_argument &) {
+            }
+        }
+        return {key, self_test, [plugin_strategy, n_prisoners] {
+                    return RunPrison(PluginPrison(*plugin_strategy, n_prisoners));
+                }};
+    } else {
+        throw std::invalid_argument{"Unknown Prisoner class name."};
+    }
+}
+
+// Returns the results of the simulations in order, which under a time budget are those started
+// within it, the last ones possibly censored.
+std::vector<SimulationResult> RunSimulations(const std::string &prisoner_class_name,
+                                             int32_t n_prisoners, int32_t n_simulations,
+                                             SimulationOptions options,
+                                             report::RunReport &run_report) {
+    run_report.strategy = prisoner_class_name;
+    run_report.engine_version = ResultsStore::kEngineVersion;
+    run_report.n_prisoners = n_prisoners;
+    run_report.n_threads = GetNWorkers(n_simulations, options);
+
+    auto strategy = run_report.TimePhase(
+        "strategy setup", [&] { return MakeStrategy(prisoner_class_name, n_prisoners); });
+    options.strategy_key = strategy.key;
+    options.n_prisoners = n_prisoners;
+
+    // A time budget is meant for quick looks, which the self-test would take most of.
+    if (not options.time_budget) {
+        run_report.TimePhase("self-test", strategy.self_test);
+    }
+    auto schedule_build_nanoseconds = report::GetScheduleBuildNanoseconds().load();
+    auto results = run_report.TimePhase("simulation", [&] {
+        if (options.time_budget) {
+            assert(not options.results_store_directory);
+            auto deadline = std::chrono::steady_clock::now() + *options.time_budget;
+            std::function<SimulationResult(std::chrono::steady_clock::time_point)>
+                run_simulation_until = strategy.run_simulation_until;
+            if (not run_simulation_until) {
+                run_simulation_until = [&](auto) { return strategy.run_simulation(); };
+            }
+            return RunSimulationsUntilDeadline(n_simulations, deadline, options,
+                                               run_simulation_until);
+        }
+        // Other strategies, and runs that reuse or budget simulations, run one prison at a time
+        // and draw inline.
+        auto can_run_range = not options.results_store_directory and not options.time_budget;
+        if (options.pipeline and strategy.run_pipelined_simulation and can_run_range) {
+            return RunSimulationsPipelined(n_simulations, options,
+                                           strategy.run_pipelined_simulation,
+                                           strategy.run_simulation, run_report.n_producer_threads);
+        }
+        if (options.n_interleaved_prisons > 1 and strategy.run_interleaved_simulations and
+            can_run_range) {
+            std::vector<SimulationResult> results(n_simulations);
+            strategy.run_interleaved_simulations(0, results, options);
+            run_report.n_interleaved_prisons = options.n_interleaved_prisons;
+            return results;
+        }
+        return RunSimulationsInParallel(n_simulations, options, strategy.run_simulation);
+    });
+    run_report.schedule_build_thread_seconds =
+        static_cast<double>(report::GetScheduleBuildNanoseconds() - schedule_build_nanoseconds) *
+        1e-9;
+
+    // Statistics are of the finished simulations, the rates of the report of those this run
+    // simulated.
+    std::vector<SimulationResult> finished_results;
+    std::vector<double> days_prison_ran_for;
+    std::vector<double> censored_days;
+    for (const auto &result : results) {
+        if (result.is_stored) {
+            ++run_report.n_stored_simulations;
+        } else {
+            run_report.n_days += static_cast<int64_t>(result.days);
+            run_report.n_simulations += not result.is_censored;
+        }
+        if (result.is_censored) {
+            censored_days.push_back(result.days);
+        } else {
+            finished_results.push_back(result);
+            days_prison_ran_for.push_back(result.days);
+        }
+    }
+    run_report.TimePhase("statistics", [&] {
+        if (not days_prison_ran_for.empty()) {
+            PrintDaysStatistics(days_prison_ran_for, options);
+            PrintControlVariateMean(finished_results, n_prisoners);
+        }
+        if (options.time_budget) {
+            PrintTimeBudgetSummary(days_prison_ran_for, censored_days, *options.time_budget);
+        }
+    });
+    run_report.peak_rss_kilobytes = report::GetPeakRssKilobytes();
+    return results;
+}
+
+// Solves the stage lengths of TokenPrisoner schedules for every n up to max_n_prisoners.
+void RunStageScheduleSweep(int32_t max_n_prisoners, double stage_probability, int32_t n_threads) {
+    std::vector<std::pair<int32_t, int32_t>> k_and_n_prisoners;
+    for (int32_t n_prisoners = 1; n_prisoners <= max_n_prisoners; ++n_prisoners) {
+        for (auto k_prisoners : TokenPrisoner::GetNPrisonersToVisitAtStages(n_prisoners)) {
+            k_and_n_prisoners.emplace_back(k_prisoners, n_prisoners);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto days = StageSchedule::ComputeNumbersOfDaysSoThatKPrisonersVisitTheRoomWithGivenProbability(
+        k_and_n_prisoners, stage_probability, n_threads);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Solved " << days.size() << " stage lengths for up to " << max_n_prisoners
+              << " prisoners in " << seconds.count() << " s\nStage lengths for "
+              << max_n_prisoners << " prisoners:";
+    for (size_t i = 0; i < days.size(); ++i) {
+        if (k_and_n_prisoners[i].second == max_n_prisoners) {
+            std::cout << ' ' << days[i];
+        }
+    }
+    std::cout << '\n';
+}
+
+void RunTailSplitting(const std::string &prisoner_class_name, int32_t n_prisoners,
+                      int32_t n_particles, const SimulationOptions &options) {
+    auto strategy = MakeStrategy(prisoner_class_name, n_prisoners);
+    if (not strategy.estimate_tail) {
+        throw std::invalid_argument{"The strategy doesn't support tail splitting."};
+    }
+    strategy.self_test();
+    PrintTailEstimate(strategy.estimate_tail(n_particles, {1e-2, 1e-3, 1e-4, 1e-5}, options),
+                      n_particles);
+}
+
+SimulationOptions MakeSimulationOptions(const prisoners::BatchRequest &request) {
+    SimulationOptions options;
+    options.n_threads = request.n_threads;
+    options.pin_threads = request.pin_threads;
+    options.seed = request.first_seed;
+    options.n_prisoners = request.n_prisoners;
+    return options;
+}
+
+}  // namespace
+
+namespace prisoners {
+
+void EvaluateBatch(const BatchRequest &request, std::span<double> days) {
+    if (static_cast<int64_t>(days.size()) < request.n_simulations) {
+        throw std::invalid_argument{"The days buffer is smaller than the batch."};
+    }
+    auto strategy = MakeStrategy(request.strategy, request.n_prisoners, request.parameters);
+    ForEachSimulationInParallel(
+        0, request.n_simulations, MakeSimulationOptions(request), strategy.run_simulation,
+        [days](int32_t, int64_t i, SimulationResult result) { days[i] = result.days; });
+}
+
+void AccumulateBatch(const BatchRequest &request, DaysAccumulator &accumulator) {
+    auto strategy = MakeStrategy(request.strategy, request.n_prisoners, request.parameters);
+    auto options = MakeSimulationOptions(request);
+    // One accumulator per worker, merged in worker order, so that the result doesn't depend on
+    // thread timing.
+    std::vector<DaysAccumulator> worker_accumulators(GetNWorkers(request.n_simulations, options));
+    ForEachSimulationInParallel(
+        0, request.n_simulations, options, strategy.run_simulation,
+        [&](int32_t worker, int64_t, SimulationResult result) {
+            worker_accumulators[worker].Add(result.days);
+        });
+    for (const auto &worker_accumulator : worker_accumulators) {
+        accumulator.Merge(worker_accumulator);
+    }
+}
+
+void LoadStrategyPlugin(const std::string &path) {
+    plugins::Load(path);
+}
+
+int RunCommandLine(int argc, char *argv[]) {
+    // Usage: [prisoner_class_name] [n_prisoners] [n_simulations] [options]
+    // A prisoner class name of the form table:<path> runs a strategy table from a file.
+    // Options: --threads <n_threads>, --pin-threads, --seed <seed>,
+    // --bootstrap-resamples <n_resamples>, --compare <prisoner_class_name>,
+    // --results-store <directory>, --plugin <path>, --time-budget <milliseconds>,
+    // --tail-splitting, --report-json <path>, --pipeline, --producer-threads <n>,
+    // --interleave <n_prisons>.
+    // --compare runs both strategies on common random numbers and tests whether they differ.
+    // --time-budget runs at most n_simulations simulations, as many as fit in the budget,
+    // skipping the self-test, and reports the ones stopped at the deadline as censored.
+    // --tail-splitting estimates the tail of the days by multilevel splitting instead, with
+    // n_simulations prisons per level.
+    // A run report with the time of each phase follows the statistics, --report-json also
+    // writes it to a file.
+    // --plugin loads the strategies of a shared object, see prisoners_plugin.h, and may repeat.
+    // --pipeline draws the visitors on producer threads, --producer-threads <n> of the threads
+    // or as many as run fastest, with the same days as the run seeded alike.
+    // --interleave runs that many prisons at once per thread, a day of each in turn, to overlap
+    // their cache misses at large numbers of prisoners. Seeded days are unchanged.
+
+    // Usage: StrategyTableSearch [n_prisoners] [n_generations] [checkpoint_path]
+
+    // Usage: StageScheduleSweep [max_n_prisoners] [options]
+    // Solves the TokenPrisoner stage lengths for every number of prisoners up to the maximum.
+
+    std::string prisoner_class_name = "DedicatedCounterPrisoner";
+    int32_t n_prisoners = 100;
+    int32_t n_simulations = 1000;
+    SimulationOptions options;
+    std::optional<std::string> compared_prisoner_class_name;
+    bool tail_splitting = false;
+    std::optional<std::string> report_json_path;
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" and i + 1 < argc) {
+            std::istringstream iss{argv[++i]};
+            iss >> options.n_threads;
+        } else if (arg == "--pin-threads") {
+            options.pin_threads = true;
+        } else if (arg == "--seed" and i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--bootstrap-resamples" and i + 1 < argc) {
+            std::istringstream iss{argv[++i]};
+            iss >> options.n_bootstrap_resamples;
+        } else if (arg == "--results-store" and i + 1 < argc) {
+            options.results_store_directory = argv[++i];
+        } else if (arg == "--time-budget" and i + 1 < argc) {
+            options.time_budget = std::chrono::milliseconds{std::stoll(argv[++i])};
+        } else if (arg == "--pipeline") {
+            options.pipeline = true;
+        } else if (arg == "--producer-threads" and i + 1 < argc) {
+            options.pipeline = true;
+            options.n_producer_threads = std::stoi(argv[++i]);
+        } else if (arg == "--interleave" and i + 1 < argc) {
+            options.n_interleaved_prisons = std::stoi(argv[++i]);
+        } else if (arg == "--report-json" and i + 1 < argc) {
+            report_json_path = argv[++i];
+        } else if (arg == "--tail-splitting") {
+            tail_splitting = true;
+        } else if (arg == "--plugin" and i + 1 < argc) {
+            plugins::Load(argv[++i]);
+        } else if (arg == "--compare" and i + 1 < argc) {
+            compared_prisoner_class_name = argv[++i];
+        } else if (arg.starts_with("--")) {
+            throw std::invalid_argument{"Unknown option " + arg + "."};
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() >= 1) {
+        prisoner_class_name = args[0];
+    }
+    if (args.size() >= 2) {
+        std::istringstream iss{args[1]};
+        iss >> n_prisoners;
+    }
+    if (args.size() >= 3) {
+        std::istringstream iss{args[2]};
+        iss >> n_simulations;
+    }
+
+    if (prisoner_class_name == "StrategyTableSearch") {
+        auto config = StrategyTableSearchConfig{};
+        config.n_prisoners = n_prisoners;
+        config.n_states = 2 * n_prisoners;
+        auto n_generations = n_simulations;
+        std::string checkpoint_path = args.size() >= 4 ? args[3] : "";
+        RunStrategyTableSearch(config, n_generations, checkpoint_path);
+    } else if (prisoner_class_name == "StageScheduleSweep") {
+        RunStageScheduleSweep(n_prisoners, StageScheduleShape{}.stage_probability,
+                              options.n_threads);
+    } else if (tail_splitting) {
+        RunTailSplitting(prisoner_class_name, n_prisoners, n_simulations, options);
+    } else {
+        if (options.results_store_directory and not options.seed) {
+            throw std::invalid_argument{"The results store needs a --seed."};
+        }
+        if (options.results_store_directory and options.time_budget) {
+            throw std::invalid_argument{"The results store can't be used with a time budget."};
+        }
+        if (options.pipeline and options.n_producer_threads and
+            (*options.n_producer_threads < 0 or
+             *options.n_producer_threads >= options.n_threads)) {
+            throw std::invalid_argument{"Producer threads must leave a thread to simulate."};
+        }
+        if (options.n_interleaved_prisons < 1) {
+            throw std::invalid_argument{"At least one prison must run at a time."};
+        }
+        if (options.pipeline and options.n_interleaved_prisons > 1) {
+            throw std::invalid_argument{"Pipelined runs can't interleave prisons."};
+        }
+        // Pipelined runs draw from per-simulation streams, which need a seed.
+        if ((compared_prisoner_class_name or options.pipeline) and not options.seed) {
+            options.seed = rng::GetDevice()();
+        }
+        std::vector<report::RunReport> run_reports(1);
+        auto results = RunSimulations(prisoner_class_name, n_prisoners, n_simulations, options,
+                                      run_reports.back());
+        if (compared_prisoner_class_name) {
+            std::cout << "\nCompared with " << *compared_prisoner_class_name << ":\n";
+            // Under a time budget, the compared strategy runs the simulations the first one
+            // started, to the end, and the ones the first one finished are compared, so that
+            // they stay paired.
+            auto n_compared_simulations = static_cast<int32_t>(results.size());
+            options.time_budget.reset();
+            auto compared_results =
+                RunSimulations(*compared_prisoner_class_name, n_prisoners,
+                               n_compared_simulations, options, run_reports.emplace_back());
+            std::vector<double> days_prison_ran_for;
+            std::vector<double> compared_days_prison_ran_for;
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (not results[i].is_censored) {
+                    days_prison_ran_for.push_back(results[i].days);
+                    compared_days_prison_ran_for.push_back(compared_results[i].days);
+                }
+            }
+            PrintDaysComparison(days_prison_ran_for, compared_days_prison_ran_for, options);
+        }
+
+        for (const auto &run_report : run_reports) {
+            std::cout << '\n';
+            run_report.Print(std::cout);
+        }
+        std::cout << '\n';
+        if (report_json_path) {
+            std::ofstream file{*report_json_path};
+            file << '[';
+            for (size_t i = 0; i < run_reports.size(); ++i) {
+                file << (i > 0 ? ",\n " : "");
+                run_reports[i].WriteJson(file);
+            }
+            file << "]\n";
+            if (not file) {
+                throw std::runtime_error{"Cannot write run report."};
+            }
+        }
+    }
+
+    return 0;
+}
+
+}  // namespace prisoners
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+
+// Batch evaluation API for embedding the simulator, implemented by prisoners.cpp, which is
+// the libprisoners.a target of the Makefile. Nothing else of the simulator is visible to
+// embedders.
+namespace prisoners {
+
+// Parameters of the strategies that have them. Unset ones keep the strategy's defaults, and
+// ones the strategy doesn't have are ignored.
+struct StrategyParameters {
+    // Stages of TokenPrisoner, RegisterTokenPrisoner<k> and HierarchicalCounterPrisoner.
+    std::optional<double> stage_probability;
+    std::optional<double> after_first_cycle_stage_length_multiplier;
+    // Cycles of TokenPrisoner and RegisterTokenPrisoner<k> schedules, where a limit of 0 cycles
+    // means none.
+    std::optional<double> per_cycle_stage_length_ratio;
+    std::optional<int32_t> max_n_cycles;
+    // DynamicCounterPrisoner.
+    std::optional<int32_t> snowball_stage_length;
+    // Assistant levels of HierarchicalCounterPrisoner.
+    std::optional<int32_t> n_counter_levels;
+    // Token cycles of TokenThenCounterPrisoner before the counter.
+    std::optional<int32_t> n_token_cycles;
+};
+
+struct BatchRequest {
+    // A prisoner class name as accepted on the command line, table:<path> included. It is
+    // resolved once per batch.
+    std::string strategy = "DedicatedCounterPrisoner";
+    StrategyParameters parameters;
+    int32_t n_prisoners = 100;
+    // Simulation i of the batch runs with seed first_seed + i, as with --seed.
+    uint64_t first_seed = 0;
+    int64_t n_simulations = 0;
+    int32_t n_threads = 1;
+    bool pin_threads = false;
+};
+
+// Mean, variance and range of days, mergeable across workers and batches.
+struct DaysAccumulator {
+    int64_t count = 0;
+    double mean = 0;
+    // Sum of squared deviations from the mean.
+    double m2 = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void Add(double days) {
+        ++count;
+        auto delta = days - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (days - mean);
+        min = std::min(min, days);
+        max = std::max(max, days);
+    }
+
+    void Merge(const DaysAccumulator &other) {
+        if (other.count == 0) {
+            return;
+        }
+        auto count_sum = count + other.count;
+        auto delta = other.mean - mean;
+        mean += delta * static_cast<double>(other.count) / static_cast<double>(count_sum);
+        m2 += other.m2 + delta * delta * static_cast<double>(count) *
+                             static_cast<double>(other.count) / static_cast<double>(count_sum);
+        count = count_sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    [[nodiscard]] double GetVariance() const {
+        return count > 0 ? m2 / static_cast<double>(count) : 0;
+    }
+};
+
+// Writes the days of simulation i into days[i]. days must hold request.n_simulations values.
+void EvaluateBatch(const BatchRequest &request, std::span<double> days);
+
+// Adds the days of every simulation to accumulator, so that batches of consecutive seeds can
+// be accumulated in turn.
+void AccumulateBatch(const BatchRequest &request, DaysAccumulator &accumulator);
+
+// Makes the strategies of a plugin, see prisoners_plugin.h, available by name to batches.
+void LoadStrategyPlugin(const std::string &path);
+
+// The command line driver that main.cpp runs. Throws on invalid arguments.
+int RunCommandLine(int argc, char *argv[]);
+
+}  // namespace prisoners
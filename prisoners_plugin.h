@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// C interface of strategy plugins, shared objects loaded with --plugin <path>. The host draws
+// the visitors, checks claims, runs the simulations in parallel and computes their statistics;
+// the plugin only moves its prisoners and the light, a batch of days per call. A strategy named
+// Plugin<name> of a built-in strategy is a port of it, and its self-test checks that it takes
+// the same days. dedicated_counter_plugin.c is an example.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PRISONERS_PLUGIN_ABI_VERSION 1
+#define PRISONERS_PLUGIN_GET_STRATEGIES_SYMBOL "prisoners_plugin_get_strategies"
+
+typedef struct PrisonersPluginStrategy {
+    // The prisoner class name the strategy is run by.
+    const char *name;
+    // Returns the state of a new simulation of n_prisoners prisoners with the light off. It is
+    // called on the thread that runs the simulation, and simulations may run concurrently.
+    void *(*create_simulation)(int32_t n_prisoners);
+    // Lets visitors[i] into the room on the next day, for i < n_days, and returns the first i
+    // on which the visitor claims that everyone has been in the room, or n_days if nobody does.
+    int64_t (*run_days)(void *simulation, const int32_t *visitors, int64_t n_days);
+    void (*destroy_simulation)(void *simulation);
+} PrisonersPluginStrategy;
+
+// The function a plugin exports as PRISONERS_PLUGIN_GET_STRATEGIES_SYMBOL. It returns the
+// plugin's strategies and sets *n_strategies to their number, or returns NULL if it doesn't
+// support abi_version. The strategies must stay valid while the plugin is loaded.
+typedef const PrisonersPluginStrategy *(*PrisonersPluginGetStrategies)(int32_t abi_version,
+                                                                       int32_t *n_strategies);
+
+#ifdef __cplusplus
+}
+#endif